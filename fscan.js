@@ -16,7 +16,71 @@ const Error = {
     HeaderInvalid:4,
     HeaderChildren:5,
     HeaderAlloc:6,
-    HeaderFormatValidity:7
+    HeaderFormatValidity:7,
+    SectorNotAllocated:8,
+    SectorOverlap:9,
+    HeaderExtents:10,
+    DirIndexMissing:11
+}
+
+// fnv-1a, as the kernel hashes names for the directory index
+function nameHash(name)
+{
+    let hash = 2166136261
+    for(let i=0;i<name.length;i++)
+    {
+        hash = Math.imul(hash ^ name.charCodeAt(i),16777619) >>> 0
+    }
+    return hash
+}
+
+// every record has to be reachable from the probe sequence of its hash
+function checkIndex(header,children,path)
+{
+    const slots = header.dirIndexSectors * 64
+    const base = header.dirIndex * 512
+    for(const c of children)
+    {
+        const hash = nameHash(c.name)
+        let found = false
+        for(let i=0,slot=hash & (slots-1);i<slots;i++,slot=(slot+1) & (slots-1))
+        {
+            const h = buffer.readUInt32LE(base + slot*8)
+            const sector = buffer.readUInt32LE(base + slot*8 + 4)
+            if(sector == 0)
+                break
+            if(h == hash && sector - 1 == c.sector)
+            {
+                found = true
+                break
+            }
+        }
+        if(!found)
+        {
+            errorlist.push({error:Error.DirIndexMissing,path:`${path}/${c.name}`})
+        }
+    }
+}
+
+const INODE_EXTENTS = 32
+
+let owners = {}
+
+// every sector of a reachable node has to be marked in the bitmap, and only once
+function claim(idx,count,path)
+{
+    for(let i=idx;i<idx+count;i++)
+    {
+        if(!(bitmap[i >> 3] & (1 << (i & 7))))
+        {
+            errorlist.push({error:Error.SectorNotAllocated,path,sector:i})
+        }
+        if(owners[i] != undefined)
+        {
+            errorlist.push({error:Error.SectorOverlap,path,sector:i,owner:owners[i]})
+        }
+        owners[i] = path
+    }
 }
 
 function readh(idx)
@@ -33,36 +97,63 @@ function readh(idx)
     const alloc = content.readInt32LE(12);
     const children = content.readInt32LE(16);
     const kind = content.readInt32LE(20) == 1 ? NODEKIND_DIR : NODEKIND_FILE;
+    const extentCount = content.readInt32LE(24);
+    if(extentCount > INODE_EXTENTS)
+    {
+        return {header:null,error:Error.HeaderExtents}
+    }
+    let extents = []
+    let extentSectors = 0
+    for(let i=0;i<extentCount;i++)
+    {
+        const start = content.readInt32LE(28 + i*8)
+        const count = content.readInt32LE(32 + i*8)
+        extents.push({start,count})
+        extentSectors += count
+    }
+    if(extentSectors != alloc)
+    {
+        return {header:null,error:Error.HeaderAlloc}
+    }
+
+    const dirIndex = content.readInt32LE(28 + INODE_EXTENTS*8);
+    const dirIndexSectors = content.readInt32LE(32 + INODE_EXTENTS*8);
+
+    return {header:{index,validity,kind,size,alloc,children,extents,dirIndex,dirIndexSectors},error:0}
+}
 
-    return {header:{index,validity,kind,size,alloc,children},error:0}
+// the data of a node, its extents put back to back
+function readdata(header)
+{
+    const parts = header.extents.map(e => buffer.slice(e.start*512,(e.start+e.count)*512))
+    return Buffer.concat(parts).slice(0,header.size)
 }
 
-function readch(idx,size)
+function readch(data)
 {
     const children = [];
-    const end = idx * 512 + size;
-    let ptr = idx * 512;
-    let name = '';
-    while(ptr < end)
+    if(data.length % 512)
+        return {error:Error.ChildTableOutOfRange,children:null};
+    for(let sector=0;sector<data.length;sector+=512)
     {
-        while(1)
+        let off = 0;
+        while(off < 512)
         {
-            const b = buffer[ptr++]
-            if(b == 0)
-                break;
-            name += String.fromCharCode(b);
+            const idx = data.readInt32LE(sector + off);
+            const recLen = data.readUInt16LE(sector + off + 4);
+            const nameLen = data.readUInt16LE(sector + off + 6);
+            if(recLen < 8 || off + recLen > 512)
+                return {error:Error.ChildTableOutOfRange,children:null};
+            if(idx)
+            {
+                const name = data.toString('ascii',sector + off + 8,sector + off + 8 + nameLen);
+                if(name == '' || name.indexOf('\0') >= 0 || 8 + nameLen + 1 > recLen)
+                    return {error:Error.InvalidChildName,children:null};
+                children.push({name,idx,sector:sector/512});
+            }
+            off += recLen;
         }
-        if(name == '')
-            return {error:Error.InvalidChildName,children:null};
-        children.push({
-            name,
-            idx:buffer.readInt32LE(ptr)
-        });
-        ptr += 4;
-        name='';
-    }
-    if(ptr > end)
-        return {error:Error.InvalidChildName,children:null};
+    }
     return {error:0,children};
 }
 
@@ -81,10 +172,20 @@ function readn(idx,path)
         errorlist.push(r)
         return r
     }
+    claim(idx,1,path || '/')
+    for(const e of header.extents)
+    {
+        claim(e.start,e.count,path || '/')
+    }
     if(header.kind == NODEKIND_DIR)
     {
         let dir = {};
-        const {children,error} = readch(idx+1,header.size);
+        const {children,error} = readch(readdata(header));
+        if(!error && header.dirIndex)
+        {
+            claim(header.dirIndex,header.dirIndexSectors,path || '/')
+            checkIndex(header,children,path)
+        }
         if(error > 0)
         {
             const r = {error,path};
@@ -104,9 +205,8 @@ function readn(idx,path)
         return ret || {node:dir,error:0};
     }
     else{
-        const beg = (idx+1)*512;
         return {
-            node: buffer.slice(beg, beg+header.size),
+            node: readdata(header),
             error:0
         };
     }
@@ -136,9 +236,30 @@ function showNode(node,depth)
 }
 
 const allocptr = buffer.readInt32LE(0);
+const bitmapStart = buffer.readInt32LE(8);
+const bitmapSectors = buffer.readInt32LE(12);
+const diskSectors = buffer.readInt32LE(16);
+// set up by the first mount, the image is only consistent once its journal has been replayed
+const journalStart = buffer.readInt32LE(20);
+const journalSectors = buffer.readInt32LE(24);
+const bitmap = buffer.slice(bitmapStart*512,(bitmapStart+bitmapSectors)*512);
 const rootptr = buffer.readInt32LE(512);
 
+claim(0,bitmapStart + bitmapSectors,'(metadata)')
+claim(journalStart,journalSectors,'(journal)')
 let {error , node, path} = readn(rootptr,'');
+if(!error && errorlist.length)
+{
+    error = errorlist[0].error
+}
+let leaked = 0
+for(let i=0;i<diskSectors;i++)
+{
+    if((bitmap[i >> 3] & (1 << (i & 7))) && owners[i] == undefined)
+    {
+        leaked++
+    }
+}
 if(error > 0)
 {
     console.error('error:',errorlist);
@@ -156,6 +277,6 @@ if(process.argv.length > 3)
 if(node instanceof Buffer)
     stdout.write(node)
 else{
-    console.log({allocptr,rootptr})
+    console.log({allocptr,rootptr,leaked})
     showNode(node,0)
 }
\ No newline at end of file
@@ -4,6 +4,12 @@ const path = require('path')
 const NODEKIND_FILE =  1
 const NODEKIND_DIR  = 2
 
+// the size of the disk the image is made for, in sectors
+const DISK_SECTORS = process.argv[3] ? parseInt(process.argv[3]) : 0x8000
+const BALLOC_MAGIC = 0x70616d62
+const BITMAP_START = 2
+const BITMAP_SECTORS = Math.ceil(DISK_SECTORS / (512 * 8))
+
 function sizeToAlloc(s)
 {
     if(s % 512 == 0)
@@ -16,6 +22,46 @@ function sizeToAlloc(s)
     }
 }
 
+function direntSize(name)
+{
+    return (8 + name.length + 1 + 3) & ~3
+}
+
+// directory records (index, rec_len, name_len, name\0) never cross a sector,
+// the last record of a sector stretches to its end
+function packDir(children)
+{
+    let sectors = []
+    let sector = null
+    let off = 0
+    let last = 0
+    for(const c in children)
+    {
+        const size = direntSize(c)
+        if(sector == null || off + size > 512)
+        {
+            if(sector != null)
+            {
+                sector.writeUInt16LE(512 - last,last + 4)
+            }
+            sector = Buffer.alloc(512)
+            sectors.push(sector)
+            off = 0
+        }
+        sector.writeUInt32LE(children[c].index || 0,off)
+        sector.writeUInt16LE(size,off + 4)
+        sector.writeUInt16LE(c.length,off + 6)
+        sector.write(c,off + 8,'ascii')
+        last = off
+        off += size
+    }
+    if(sector != null)
+    {
+        sector.writeUInt16LE(512 - last,last + 4)
+    }
+    return Buffer.concat(sectors)
+}
+
 function loadFile(file)
 {
     let buf;
@@ -109,16 +155,12 @@ for (let i=0;i<nodes.length;i++)
     let node = nodes[i]
     if(node.kind == NODEKIND_DIR)
     {
-        node.size = 0
-        for(c in node.children)
-        {
-            node.size += c.length + 5
-        }
+        node.size = packDir(node.children).length
     }
     node.alloc = sizeToAlloc(node.size)
 }
 
-let allocPtr = 2
+let allocPtr = BITMAP_START + BITMAP_SECTORS
 
 for(let i=0;i<nodes.length;i++)
 {
@@ -132,18 +174,7 @@ for(let i=0;i<nodes.length;i++)
     let node = nodes[i]
     if(node.kind == NODEKIND_DIR)
     {
-        let content = Buffer.alloc(0)
-        for(c in node.children)
-        {
-            const chnamelen = c.length
-            const chindex = node.children[c].index
-            let entry = Buffer.alloc(chnamelen + 5)
-            entry.write(c,'ascii')
-            entry.writeUInt8(0,chnamelen)
-            entry.writeUInt32LE(chindex,chnamelen + 1)
-            content = Buffer.concat([content,entry])
-        }
-        content = Buffer.concat([content,Buffer.alloc(sizeToAlloc(content.length)*512 - content.length)])
+        let content = packDir(node.children)
         node.content = content
     }
 }
@@ -157,7 +188,11 @@ for(let i=0;i<nodes.length;i++)
     header.writeUInt32LE(node.size,8); // size
     header.writeUInt32LE(node.alloc,12); // size
     header.writeUInt32LE(node.kind == NODEKIND_DIR ? Object.keys(node.children).length : 0,16); // child count
-    header.writeUInt32LE(node.kind == NODEKIND_DIR ? 1 : 0,20); // child count
+    header.writeUInt32LE(node.kind == NODEKIND_DIR ? 1 : 0,20); // type
+    // the data follows the header as a single extent
+    header.writeUInt32LE(node.alloc ? 1 : 0,24); // extent count
+    header.writeUInt32LE(node.index + 1,28); // extent start
+    header.writeUInt32LE(node.alloc,32); // extent sectors
     node.header = header
 }
 
@@ -176,7 +211,18 @@ nodes.sort((n1,n2)=>{
 })
 
 let allocPtrBlock = Buffer.alloc(512)
-allocPtrBlock.writeUInt32LE(allocPtr,0)
+allocPtrBlock.writeUInt32LE(allocPtr,0) // cursor
+allocPtrBlock.writeUInt32LE(BALLOC_MAGIC,4)
+allocPtrBlock.writeUInt32LE(BITMAP_START,8)
+allocPtrBlock.writeUInt32LE(BITMAP_SECTORS,12)
+allocPtrBlock.writeUInt32LE(DISK_SECTORS,16)
+
+// every sector below allocPtr is in use
+let bitmapBlock = Buffer.alloc(BITMAP_SECTORS * 512)
+for(let i=0;i<allocPtr;i++)
+{
+    bitmapBlock[i >> 3] |= 1 << (i & 7)
+}
 
 let rootPtrBlock = Buffer.alloc(512)
 rootPtrBlock.writeUInt32LE(fs_tree.index,0)
@@ -185,6 +231,7 @@ let buffers = []
 
 buffers.push(allocPtrBlock)
 buffers.push(rootPtrBlock)
+buffers.push(bitmapBlock)
 
 for(let i=0;i<nodes.length;i++)
 {
@@ -7,7 +7,9 @@
 
 void asm_outb(unsigned short port, unsigned char byte);
 void asm_outw(unsigned short port, unsigned short word);
+void asm_outl(unsigned short port, uint32_t dword);
 uint8_t asm_inb(unsigned short port);
+uint32_t asm_inl(unsigned short port);
 void asm_lgdt(gdtarray arr);
 void asm_lidt(idtarray arr);
 
@@ -16,6 +18,8 @@ void asm_disk_read(uint32_t sector, uint32_t count, uint32_t buffer);
 
 void asm_cli();
 void asm_sti();
+uint32_t asm_cli_save(); // returns eflags as they were
+void asm_restore_flags(uint32_t flags);
 void asm_insw(uint16_t port, void *address, uint32_t count);
 void asm_outsw(uint16_t port, void *address, uint32_t count);
 uint32_t asm_get_cr2();
@@ -26,5 +30,7 @@ void asm_task_switch();
 void asm_usermode(void *userprog);
 void asm_set_sps(uint32_t ebp, uint32_t esp);
 void asm_flush_TLB();
+void asm_enable_wp();
+uint32_t asm_rdtsc();
 void asm_flush_tss();
 #endif
\ No newline at end of file
@@ -3,13 +3,17 @@
 
     global asm_outb
     global asm_outw
+    global asm_outl
     global asm_inb
+    global asm_inl
     global asm_outsw
     global asm_insw
     global asm_lgdt
     global asm_lidt
     global asm_cli
     global asm_sti
+    global asm_cli_save
+    global asm_restore_flags
 
     global switch_page_directory
     global paging_physcpy
@@ -21,6 +25,8 @@
     global asm_task_switch
     global asm_set_sps 
     global asm_flush_TLB
+    global asm_enable_wp
+    global asm_rdtsc
     global asm_flush_tss
     global asm_get_cr2
     global task_sleep
@@ -54,6 +60,18 @@ asm_outw:
     pop ebp
     ret
 
+asm_outl:
+    push ebp
+    mov ebp, esp
+
+    mov eax, [ebp + 12]    ; move the data to be sent into the eax register
+    mov dx, [ebp + 8]    ; move the address of the I/O port into the dx register
+    out dx, eax           ; send the data to the I/O port
+
+    mov esp, ebp
+    pop ebp
+    ret
+
 asm_inb:
     push ebp
     mov ebp, esp
@@ -63,6 +81,17 @@ asm_inb:
     mov dx, [ebp + 8]    ; move the address of the I/O port into the dx register
     in al, dx           ; send the data to the I/O port
 
+    mov esp, ebp
+    pop ebp
+    ret
+
+asm_inl:
+    push ebp
+    mov ebp, esp
+
+    mov dx, [ebp + 8]    ; move the address of the I/O port into the dx register
+    in eax, dx           ; read the data from the I/O port
+
     mov esp, ebp
     pop ebp
     ret
@@ -167,6 +196,15 @@ asm_cli:
 asm_sti:
     sti
     ret
+asm_cli_save:
+    pushf
+    pop eax
+    cli
+    ret
+asm_restore_flags:
+    push dword [esp + 4]
+    popf
+    ret
 asm_set_sps:
     mov eax, [esp + 4]
     mov ebx, [esp + 8]
@@ -178,6 +216,14 @@ asm_flush_TLB:
     mov eax, cr3
     mov cr3, eax
     ret
+asm_enable_wp:
+    mov eax, cr0
+    or eax, 0x10000
+    mov cr0, eax
+    ret
+asm_rdtsc:
+    rdtsc
+    ret
 asm_flush_tss:
     mov ax, 0x2b
     ltr ax
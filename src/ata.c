@@ -2,7 +2,9 @@
 #include <asm.h>
 #include <task.h>
 #include <util.h>
-#include <lock.h>
+#include <pci.h>
+#include <paging.h>
+#include <kutil.h>
 
 #define ATA_REG_DATA 0x1f0
 #define ATA_REG_ERROR 0x1f1
@@ -49,91 +51,485 @@
 #define ATA_CMD_IDENTIFY_PACKET 0xA1
 #define ATA_CMD_IDENTIFY 0xEC
 
-uint32_t ata_current_lba;
-void *ata_current_buffer;
-ata_op ata_current_op;
-task_t *ata_task = NULL;
-ksemaphore_t disk_sem;
+#define BM_REG_COMMAND 0x0
+#define BM_REG_STATUS 0x2
+#define BM_REG_PRDT 0x4
 
-void ata_init()
+#define BM_COMMAND_START 0x01
+#define BM_COMMAND_READ 0x08 // the controller writes into memory
+
+#define BM_STATUS_ACTIVE 0x01
+#define BM_STATUS_ERR 0x02
+#define BM_STATUS_IRQ 0x04
+
+#define ATA_DEADLINE 16 // in dispatched commands
+
+#define PRD_EOT 0x8000
+#define PRD_MAX_ENTRIES (0x1000 / sizeof(prd_t))
+
+typedef struct
 {
-    ksemaphore_init(&disk_sem, 1);
-    load_int_handler(INTCODE_ATA, ata_ihandler);
-}
+    uint32_t address;
+    uint16_t count; // 0 stands for 64K
+    uint16_t flags;
+} __attribute__((packed)) prd_t;
 
-void ata_read(uint32_t sector, void *buffer)
+struct ata_request_t
 {
-    ksemaphore_wait(&disk_sem);
-    ata_current_buffer = buffer;
-    ata_current_op = ATA_OP_READ;
-    ata_current_lba = sector;
+    uint32_t lba;
+    uint32_t count;
+    void *buffer;
+    ata_op op;
+    uint32_t deadline;
+    uint8_t done;
+    uint8_t failed; // the drive reported an error, the data isn't to be trusted
+    task_t *task;
+    ata_callback_t callback; // for requests nobody waits on, run from the interrupt handler
+    void *arg;
+    ata_request_t *next;
+};
 
-    while (asm_inb(ATA_REG_STATUS) & ATA_STATUS_BSY)
-        ;
-    while ((asm_inb(ATA_REG_STATUS) & ATA_STATUS_DRDY) == 0)
-        ;
-    asm_outb(ATA_REG_SECCOUNT, 1);
-    asm_outb(ATA_REG_LBA_LOW, sector & 0xff);
-    asm_outb(ATA_REG_LBA_MID, (sector >> 8) & 0xff);
-    asm_outb(ATA_REG_LBA_HIGH, (sector >> 16) & 0xff);
-    asm_outb(ATA_REG_DH, 0xe0 | ((sector >> 24) & 0x0f));
-    asm_outb(ATA_REG_CMD, ATA_CMD_READ_PIO);
+ata_request_t *ata_queue = NULL;  // pending requests sorted by lba
+ata_request_t *ata_active = NULL; // the command in flight, chained through next
+ata_request_t *ata_segment;       // the request the next block belongs to
+uint32_t ata_segment_left;
+uint32_t ata_current_count;
+void *ata_current_buffer;
+ata_op ata_current_op;
+uint32_t ata_head_lba = 0;
+uint32_t ata_dispatches = 0;
+uint32_t ata_plugged = 0;
 
-    ata_task = task_curtask();
-    task_sleep();
-    ksemaphore_signal(&disk_sem);
-}
+uint32_t ata_disk_sectors = 0; // what the drive can address with 28 bit LBA, 0 if it didn't say
+uint16_t ata_bmbase = 0;        // 0 if there is no bus master, PIO is used then
+uint8_t ata_current_dma = 0;
+prd_t *ata_prdt;
 
-void ata_write(uint32_t sector, void *buffer)
+void ata_command(uint32_t sector, uint32_t count, uint8_t command)
 {
-    ksemaphore_wait(&disk_sem);
-    ata_current_buffer = buffer;
-    ata_current_op = ATA_OP_WRITE;
-    ata_current_lba = sector;
-
     while (asm_inb(ATA_REG_STATUS) & ATA_STATUS_BSY)
         ;
     while ((asm_inb(ATA_REG_STATUS) & ATA_STATUS_DRDY) == 0)
         ;
-    asm_outb(ATA_REG_SECCOUNT, 1);
+    // a sector count of 0 stands for 256 sectors
+    asm_outb(ATA_REG_SECCOUNT, count & 0xff);
     asm_outb(ATA_REG_LBA_LOW, sector & 0xff);
     asm_outb(ATA_REG_LBA_MID, (sector >> 8) & 0xff);
     asm_outb(ATA_REG_LBA_HIGH, (sector >> 16) & 0xff);
     asm_outb(ATA_REG_DH, 0xe0 | ((sector >> 24) & 0x0f));
-    asm_outb(ATA_REG_CMD, ATA_CMD_WRITE_PIO);
+    asm_outb(ATA_REG_CMD, command);
+}
+
+void ata_segment_advance()
+{
+    ata_current_buffer += SECTOR_SIZE;
+    ata_current_count--;
+    if (--ata_segment_left == 0 && ata_segment->next)
+    {
+        ata_segment = ata_segment->next;
+        ata_segment_left = ata_segment->count;
+        ata_current_buffer = ata_segment->buffer;
+    }
+}
 
+void ata_write_block()
+{
     while ((asm_inb(ATA_REG_STATUS) & ATA_STATUS_DRQ) == 0)
         ;
 
     uint32_t i = 0;
     while (i < SECTOR_SIZE / 2)
     {
-        asm_outw(ATA_REG_DATA, ((uint16_t *)buffer)[i++]);
+        asm_outw(ATA_REG_DATA, ((uint16_t *)ata_current_buffer)[i++]);
     }
+    ata_segment_advance();
+}
 
-    ata_task = task_curtask();
-    task_sleep();
-    ksemaphore_signal(&disk_sem);
+void ata_read_block()
+{
+    asm_insw(ATA_REG_DATA, ata_current_buffer, SECTOR_SIZE / 2);
+    ata_segment_advance();
 }
 
-void ata_ihandler(__attribute__((unused)) registers *regs)
+void ata_dma_init()
+{
+    uint32_t device = pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE);
+    if (device == PCI_NONE)
+    {
+        return;
+    }
+    uint32_t bar4 = pci_read(device, PCI_REG_BAR4);
+    if (!(bar4 & 0x1)) // the bus master registers must be in the I/O space
+    {
+        return;
+    }
+    uint32_t command = pci_read(device, PCI_REG_COMMAND) & 0xffff;
+    pci_write(device, PCI_REG_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+    ata_bmbase = bar4 & 0xfffc;
+    // one frame, so the table never crosses a 64K boundary
+    ata_prdt = kmalloc_a(0x1000);
+}
+
+// polled, before any request is queued
+void ata_identify()
+{
+    ata_command(0, 0, ATA_CMD_IDENTIFY);
+    uint8_t status;
+    while ((status = asm_inb(ATA_REG_STATUS)) & ATA_STATUS_BSY)
+        ;
+    while (!(status & (ATA_STATUS_DRQ | ATA_STATUS_ERR)))
+    {
+        status = asm_inb(ATA_REG_STATUS);
+    }
+    if (status & ATA_STATUS_ERR)
+    {
+        return;
+    }
+    uint16_t *data = kmalloc(SECTOR_SIZE);
+    asm_insw(ATA_REG_DATA, data, SECTOR_SIZE / 2);
+    ata_disk_sectors = data[60] | (uint32_t)data[61] << 16;
+    kfree(data);
+}
+
+void ata_init()
 {
+    ata_dma_init();
+    load_int_handler(INTCODE_ATA, ata_ihandler);
+    ata_identify();
+}
+
+uint32_t ata_sectors()
+{
+    return ata_disk_sectors;
+}
 
-    if (ata_current_op == ATA_OP_WRITE)
+// builds the PRD table from the physical frames backing the buffers of the command
+uint8_t ata_dma_prepare(ata_request_t *command)
+{
+    if (!ata_bmbase)
+    {
+        return 0;
+    }
+    uint32_t index = 0;
+    uint32_t entry_bytes = 0;
+    for (ata_request_t *req = command; req; req = req->next)
     {
-        ata_current_op = ATA_OP_FLUSH;
-        asm_outb(ATA_REG_CMD, ATA_CMD_CACHE_FLUSH);
+        if ((uint32_t)req->buffer & 0x1)
+        {
+            return 0;
+        }
+        uint32_t address = (uint32_t)req->buffer;
+        uint32_t bytes = req->count * SECTOR_SIZE;
+        while (bytes)
+        {
+            uint32_t physical = get_physical_address(address);
+            uint32_t len = min(bytes, 0x1000 - address % 0x1000);
+            // regions may be merged as long as they don't cross a 64K boundary
+            if (index && ata_prdt[index - 1].address + entry_bytes == physical && physical % 0x10000)
+            {
+                entry_bytes += len;
+            }
+            else
+            {
+                if (index == PRD_MAX_ENTRIES)
+                {
+                    return 0;
+                }
+                index++;
+                ata_prdt[index - 1].address = physical;
+                ata_prdt[index - 1].flags = 0;
+                entry_bytes = len;
+            }
+            ata_prdt[index - 1].count = entry_bytes & 0xffff;
+            address += len;
+            bytes -= len;
+        }
+    }
+    ata_prdt[index - 1].flags = PRD_EOT;
+    return 1;
+}
+
+void ata_dma_start(uint32_t sector, uint32_t count, uint8_t command, uint8_t read)
+{
+    uint8_t direction = read ? BM_COMMAND_READ : 0;
+    asm_outl(ata_bmbase + BM_REG_PRDT, get_physical_address((uint32_t)ata_prdt));
+    asm_outb(ata_bmbase + BM_REG_COMMAND, direction);
+    asm_outb(ata_bmbase + BM_REG_STATUS, BM_STATUS_ERR | BM_STATUS_IRQ);
+    ata_command(sector, count, command);
+    asm_outb(ata_bmbase + BM_REG_COMMAND, direction | BM_COMMAND_START);
+}
+
+// 0 if the transfer failed
+uint8_t ata_dma_stop()
+{
+    asm_outb(ata_bmbase + BM_REG_COMMAND, 0);
+    uint8_t status = asm_inb(ata_bmbase + BM_REG_STATUS);
+    asm_outb(ata_bmbase + BM_REG_STATUS, BM_STATUS_ERR | BM_STATUS_IRQ);
+    ata_current_dma = 0;
+    return !(status & BM_STATUS_ERR);
+}
+
+void ata_enqueue(ata_request_t *req)
+{
+    ata_request_t **ptr = &ata_queue;
+    while (*ptr && (*ptr)->lba <= req->lba)
+    {
+        ptr = &(*ptr)->next;
+    }
+    req->next = *ptr;
+    *ptr = req;
+}
+
+// C-LOOK: keep sweeping upwards from the head, unless a request missed its deadline
+ata_request_t **ata_pick()
+{
+    ata_request_t **pick = NULL;
+    ata_request_t **expired = NULL;
+    for (ata_request_t **ptr = &ata_queue; *ptr; ptr = &(*ptr)->next)
+    {
+        if ((*ptr)->deadline <= ata_dispatches && (!expired || (*ptr)->deadline < (*expired)->deadline))
+        {
+            expired = ptr;
+        }
+        if (!pick && (*ptr)->lba >= ata_head_lba)
+        {
+            pick = ptr;
+        }
+    }
+    if (expired)
+    {
+        return expired;
+    }
+    return pick ? pick : &ata_queue;
+}
+
+void ata_dispatch()
+{
+    if (ata_active || ata_plugged || !ata_queue)
+    {
+        return;
+    }
+    ata_request_t **ptr = ata_pick();
+    ata_request_t *first = *ptr;
+    ata_request_t *last = first;
+    uint32_t count = first->count;
+    // requests for the following blocks join the same command
+    while (last->next && last->next->op == first->op && last->next->lba == last->lba + last->count &&
+           count + last->next->count <= ATA_MAX_SECTORS)
+    {
+        last = last->next;
+        count += last->count;
+    }
+    *ptr = last->next;
+    last->next = NULL;
+
+    ata_active = first;
+    ata_segment = first;
+    ata_segment_left = first->count;
+    ata_current_buffer = first->buffer;
+    ata_current_count = count;
+    ata_current_op = first->op;
+    ata_dispatches++;
+
+    if (first->op == ATA_OP_FLUSH)
+    {
+        ata_current_dma = 0;
+        ata_command(0, 0, ATA_CMD_CACHE_FLUSH);
+        return;
+    }
+    ata_head_lba = first->lba + count;
+    uint8_t read = first->op == ATA_OP_READ;
+    ata_current_dma = ata_dma_prepare(first);
+    if (ata_current_dma)
+    {
+        ata_dma_start(first->lba, count, read ? ATA_CMD_READ_DMA : ATA_CMD_WRITE_DMA, read);
     }
     else
     {
-        if (ata_current_op == ATA_OP_READ)
+        ata_command(first->lba, count, read ? ATA_CMD_READ_PIO : ATA_CMD_WRITE_PIO);
+        if (!read)
+        {
+            ata_write_block();
+        }
+    }
+}
+
+void ata_complete(uint8_t failed)
+{
+    ata_request_t *req = ata_active;
+    ata_active = NULL;
+    while (req)
+    {
+        ata_request_t *next = req->next;
+        req->done = 1;
+        req->failed = failed;
+        if (req->callback)
+        {
+            req->callback(req->arg, !failed);
+            kfree(req);
+        }
+        else if (req->task)
         {
-            asm_insw(ATA_REG_DATA, ata_current_buffer, SECTOR_SIZE / 2);
+            task_awake(req->task);
         }
-        if (ata_task)
+        req = next;
+    }
+    ata_dispatch();
+}
+
+ata_request_t *ata_submit(ata_op op, uint32_t sector, uint32_t count, void *buffer)
+{
+    ata_request_t *req = kmalloc(sizeof(ata_request_t));
+    req->lba = sector;
+    req->count = count;
+    req->buffer = buffer;
+    req->op = op;
+    req->deadline = ata_dispatches + ATA_DEADLINE;
+    req->done = 0;
+    req->failed = 0;
+    req->task = NULL;
+    req->callback = NULL;
+    ata_enqueue(req);
+    ata_dispatch();
+    return req;
+}
+
+// the request is freed once the callback returns
+void ata_submit_async(ata_op op, uint32_t sector, uint32_t count, void *buffer, ata_callback_t callback, void *arg)
+{
+    ata_plug();
+    ata_request_t *req = ata_submit(op, sector, count, buffer);
+    req->callback = callback;
+    req->arg = arg;
+    ata_unplug();
+}
+
+// holds back dispatching while a batch of requests is being submitted
+void ata_plug()
+{
+    ata_plugged++;
+}
+
+void ata_unplug()
+{
+    ata_plugged--;
+    ata_dispatch();
+}
+
+// 1 if the request went through
+uint8_t ata_wait(ata_request_t *req)
+{
+    // the completion interrupt must not slip in between the check and the sleep
+    uint32_t flags = asm_cli_save();
+    while (!req->done)
+    {
+        req->task = task_curtask();
+        task_sleep();
+    }
+    asm_restore_flags(flags);
+    uint8_t ok = !req->failed;
+    kfree(req);
+    return ok;
+}
+
+uint8_t ata_transfer(ata_op op, uint32_t sector, uint32_t count, void *buffer)
+{
+    uint8_t ok = 1;
+    while (count)
+    {
+        uint32_t chunk = min(count, ATA_MAX_SECTORS);
+        ok &= ata_wait(ata_submit(op, sector, chunk, buffer));
+        sector += chunk;
+        buffer += chunk * SECTOR_SIZE;
+        count -= chunk;
+    }
+    return ok;
+}
+
+uint8_t ata_read_n(uint32_t sector, uint32_t count, void *buffer)
+{
+    return ata_transfer(ATA_OP_READ, sector, count, buffer);
+}
+
+uint8_t ata_write_n(uint32_t sector, uint32_t count, void *buffer)
+{
+    return ata_transfer(ATA_OP_WRITE, sector, count, buffer);
+}
+
+// waits until everything the drive acknowledged so far is on the media
+uint8_t ata_flush()
+{
+    return ata_wait(ata_submit(ATA_OP_FLUSH, 0, 0, NULL));
+}
+
+uint8_t ata_read(uint32_t sector, void *buffer)
+{
+    return ata_read_n(sector, 1, buffer);
+}
+
+uint8_t ata_write(uint32_t sector, void *buffer)
+{
+    return ata_write_n(sector, 1, buffer);
+}
+
+// a failed DMA command is given to the drive again over PIO, and DMA isn't used from then on
+void ata_dma_fallback()
+{
+    kprintf("KERNEL : disk DMA transfer failed, falling back to PIO\n");
+    ata_bmbase = 0;
+    ata_request_t *req = ata_active;
+    ata_active = NULL;
+    while (req)
+    {
+        ata_request_t *next = req->next;
+        ata_enqueue(req);
+        req = next;
+    }
+    ata_dispatch();
+}
+
+void ata_ihandler(__attribute__((unused)) registers *regs)
+{
+    // reading the status register acknowledges the interrupt
+    uint8_t status = asm_inb(ATA_REG_STATUS);
+    if (!ata_active)
+    {
+        return;
+    }
+
+    uint8_t failed = (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) != 0;
+    if (ata_current_dma)
+    {
+        // a DMA command raises a single interrupt once all blocks are moved
+        if (!ata_dma_stop() || failed)
+        {
+            ata_dma_fallback();
+            return;
+        }
+        ata_current_count = 0;
+    }
+    if (failed)
+    {
+        kprintf("KERNEL : disk command at sector %u failed ( error = %x )\n", ata_active->lba,
+                asm_inb(ATA_REG_ERROR));
+        ata_complete(1);
+        return;
+    }
+
+    if (ata_current_op == ATA_OP_WRITE && ata_current_count)
+    {
+        // one interrupt per written block, the last one completes the command
+        ata_write_block();
+        return;
+    }
+    if (ata_current_op == ATA_OP_READ && ata_current_count)
+    {
+        // one interrupt per block, each one with its data ready (DRQ)
+        ata_read_block();
+        if (ata_current_count)
         {
-            task_awake(ata_task);
-            ata_task = NULL;
+            return;
         }
     }
+    ata_complete(0);
 }
\ No newline at end of file
@@ -5,11 +5,7 @@
 #include <idt.h>
 
 #define SECTOR_SIZE 512
-
-void ata_read(uint32_t sector, void *buffer);
-void ata_write(uint32_t sector, void *buffer);
-void ata_ihandler(__attribute__((unused)) registers *regs);
-void ata_init();
+#define ATA_MAX_SECTORS 256
 
 typedef enum
 {
@@ -18,4 +14,25 @@ typedef enum
     ATA_OP_FLUSH,
 } ata_op;
 
+typedef struct ata_request_t ata_request_t;
+typedef void (*ata_callback_t)(void *arg, uint8_t ok);
+
+// commands may run while another task's address space is loaded,
+// so the buffers have to live on the kernel heap
+
+ata_request_t *ata_submit(ata_op op, uint32_t sector, uint32_t count, void *buffer);
+uint8_t ata_wait(ata_request_t *req);
+void ata_submit_async(ata_op op, uint32_t sector, uint32_t count, void *buffer, ata_callback_t callback, void *arg);
+void ata_plug();
+void ata_unplug();
+// these return 1 if the drive didn't report an error
+uint8_t ata_flush();
+uint8_t ata_read(uint32_t sector, void *buffer);
+uint8_t ata_write(uint32_t sector, void *buffer);
+uint8_t ata_read_n(uint32_t sector, uint32_t count, void *buffer);
+uint8_t ata_write_n(uint32_t sector, uint32_t count, void *buffer);
+void ata_ihandler(__attribute__((unused)) registers *regs);
+void ata_init();
+uint32_t ata_sectors();
+
 #endif
\ No newline at end of file
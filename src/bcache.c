@@ -0,0 +1,435 @@
+#include <bcache.h>
+#include <kutil.h>
+#include <kqueue.h>
+#include <task.h>
+#include <vec.h>
+
+#define BCACHE_BUCKETS 256
+#define BCACHE_RUN_MAX 128
+#define BCACHE_NOLBA 0xffffffff
+#define BCACHE_FLUSH_BATCH 512 // requests in flight per flush, each one is a heap allocation
+
+buf_t *bcache_pool;
+buf_t *bcache_table[BCACHE_BUCKETS];
+buf_t *bcache_head = NULL;
+buf_t *bcache_tail = NULL;
+uint32_t bcache_capacity;
+uint8_t bcache_mode;
+uint32_t bcache_run_max;
+kqueue_t bcache_waitq;
+bcache_stats_t bcache_stats;
+uint32_t bcache_ticks = 0;
+task_t *bcache_flusher_task = NULL; // set while the flusher is idle
+
+uint32_t bcache_hash(uint32_t lba)
+{
+    return lba % BCACHE_BUCKETS;
+}
+
+void bcache_lru_remove(buf_t *buf)
+{
+    if (buf->prev)
+    {
+        buf->prev->next = buf->next;
+    }
+    else
+    {
+        bcache_head = buf->next;
+    }
+    if (buf->next)
+    {
+        buf->next->prev = buf->prev;
+    }
+    else
+    {
+        bcache_tail = buf->prev;
+    }
+}
+
+void bcache_lru_push(buf_t *buf)
+{
+    buf->prev = NULL;
+    buf->next = bcache_head;
+    if (bcache_head)
+    {
+        bcache_head->prev = buf;
+    }
+    else
+    {
+        bcache_tail = buf;
+    }
+    bcache_head = buf;
+}
+
+void bcache_touch(buf_t *buf)
+{
+    bcache_lru_remove(buf);
+    bcache_lru_push(buf);
+}
+
+void bcache_init(uint32_t capacity, uint8_t mode)
+{
+    bcache_capacity = capacity;
+    bcache_mode = mode;
+    bcache_run_max = min(BCACHE_RUN_MAX, capacity / 4);
+    bcache_pool = kmalloc(capacity * sizeof(buf_t));
+    char *data = kmalloc(capacity * SECTOR_SIZE);
+    memset(bcache_table, 0, sizeof(bcache_table));
+    memset(&bcache_stats, 0, sizeof(bcache_stats_t));
+    bcache_waitq = kqueue_new();
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        buf_t *buf = &bcache_pool[i];
+        buf->lba = BCACHE_NOLBA;
+        buf->refs = 0;
+        buf->flags = 0;
+        buf->data = data + i * SECTOR_SIZE;
+        buf->hnext = NULL;
+        bcache_lru_push(buf);
+    }
+}
+
+buf_t *bcache_lookup(uint32_t lba)
+{
+    buf_t *buf = bcache_table[bcache_hash(lba)];
+    while (buf && buf->lba != lba)
+    {
+        buf = buf->hnext;
+    }
+    return buf;
+}
+
+void bcache_hash_insert(buf_t *buf, uint32_t lba)
+{
+    uint32_t bucket = bcache_hash(lba);
+    buf->lba = lba;
+    buf->hnext = bcache_table[bucket];
+    bcache_table[bucket] = buf;
+}
+
+void bcache_hash_remove(buf_t *buf)
+{
+    buf_t **ptr = &bcache_table[bcache_hash(buf->lba)];
+    while (*ptr != buf)
+    {
+        ptr = &(*ptr)->hnext;
+    }
+    *ptr = buf->hnext;
+    buf->hnext = NULL;
+    buf->lba = BCACHE_NOLBA;
+}
+
+void bcache_wait()
+{
+    kqueue_push(&bcache_waitq, (uint32_t)task_curtask());
+    task_sleep();
+}
+
+void bcache_wakeup()
+{
+    while (bcache_waitq.size)
+    {
+        task_awake((task_t *)kqueue_pop(&bcache_waitq));
+    }
+}
+
+// takes the least recently used clean block, NULL if there is none
+buf_t *bcache_reclaim()
+{
+    for (buf_t *buf = bcache_tail; buf; buf = buf->prev)
+    {
+        if (!buf->refs && !(buf->flags & (BUF_BUSY | BUF_DIRTY)))
+        {
+            if (buf->lba != BCACHE_NOLBA)
+            {
+                bcache_hash_remove(buf);
+                bcache_stats.evictions++;
+            }
+            buf->flags = 0;
+            return buf;
+        }
+    }
+    return NULL;
+}
+
+buf_t *bcache_evict()
+{
+    while (1)
+    {
+        buf_t *buf = bcache_reclaim();
+        if (buf)
+        {
+            return buf;
+        }
+        // every unreferenced block is dirty: write them all back in one go
+        uint32_t written = bcache_stats.writebacks;
+        bcache_flush();
+        if (written == bcache_stats.writebacks)
+        {
+            bcache_wait();
+        }
+    }
+}
+
+buf_t *bcache_getblk(uint32_t lba)
+{
+    while (1)
+    {
+        buf_t *buf = bcache_lookup(lba);
+        if (buf)
+        {
+            if (buf->flags & BUF_BUSY)
+            {
+                bcache_wait();
+                continue;
+            }
+            buf->refs++;
+            bcache_touch(buf);
+            return buf;
+        }
+        buf = bcache_evict();
+        if (bcache_lookup(lba)) // loaded by someone else while evicting
+        {
+            continue;
+        }
+        bcache_hash_insert(buf, lba);
+        buf->refs = 1;
+        bcache_touch(buf);
+        return buf;
+    }
+}
+
+buf_t *bcache_get(uint32_t lba)
+{
+    buf_t *buf = bcache_getblk(lba);
+    if (buf->flags & BUF_VALID)
+    {
+        bcache_stats.hits++;
+        return buf;
+    }
+    bcache_stats.misses++;
+    buf->flags |= BUF_BUSY;
+    uint8_t ok = ata_wait(ata_submit(ATA_OP_READ, lba, 1, buf->data));
+    buf->flags = (buf->flags & ~BUF_BUSY) | (ok ? BUF_VALID : 0);
+    bcache_wakeup();
+    return buf;
+}
+
+void bcache_release(buf_t *buf)
+{
+    if (--buf->refs == 0 && bcache_waitq.size)
+    {
+        bcache_wakeup();
+    }
+}
+
+void bcache_dirty(buf_t *buf)
+{
+    buf->flags |= BUF_VALID | BUF_DIRTY;
+    if (bcache_mode == BCACHE_WRITETHROUGH)
+    {
+        bcache_flush_range(buf->lba, 1);
+        ata_flush();
+    }
+}
+
+void bcache_read(uint32_t lba, uint32_t count, void *buffer)
+{
+    buf_t *run[BCACHE_RUN_MAX];
+    uint32_t i = 0;
+    while (i < count)
+    {
+        buf_t *buf = bcache_getblk(lba + i);
+        if (buf->flags & BUF_VALID)
+        {
+            bcache_stats.hits++;
+            memcpy(buffer + i * SECTOR_SIZE, buf->data, SECTOR_SIZE);
+            bcache_release(buf);
+            i++;
+            continue;
+        }
+        // gather the following missing blocks, the disk queue merges them into one command
+        buf->flags |= BUF_BUSY;
+        run[0] = buf;
+        uint32_t len = 1;
+        while (i + len < count && len < bcache_run_max && !bcache_lookup(lba + i + len))
+        {
+            buf_t *next = bcache_getblk(lba + i + len);
+            if (next->flags & BUF_VALID)
+            {
+                bcache_release(next);
+                break;
+            }
+            next->flags |= BUF_BUSY;
+            run[len++] = next;
+        }
+        ata_request_t *requests[BCACHE_RUN_MAX];
+        ata_plug();
+        for (uint32_t j = 0; j < len; j++)
+        {
+            requests[j] = ata_submit(ATA_OP_READ, lba + i + j, 1, run[j]->data);
+        }
+        ata_unplug();
+        for (uint32_t j = 0; j < len; j++)
+        {
+            uint8_t ok = ata_wait(requests[j]);
+            memcpy(buffer + (i + j) * SECTOR_SIZE, run[j]->data, SECTOR_SIZE);
+            run[j]->flags = (run[j]->flags & ~BUF_BUSY) | (ok ? BUF_VALID : 0);
+            run[j]->refs--;
+        }
+        bcache_stats.misses += len;
+        bcache_wakeup();
+        i += len;
+    }
+}
+
+void bcache_prefetch_done(void *arg, uint8_t ok)
+{
+    buf_t *buf = arg;
+    // a block that failed to read stays invalid, whoever needs it reads it again
+    buf->flags = (buf->flags & ~BUF_BUSY) | (ok ? BUF_VALID : 0);
+    bcache_wakeup();
+}
+
+// starts reading the blocks that aren't cached yet and returns without waiting for them,
+// stops early rather than writing back dirty blocks to make room
+void bcache_prefetch(uint32_t lba, uint32_t count)
+{
+    ata_plug();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (bcache_lookup(lba + i))
+        {
+            continue;
+        }
+        buf_t *buf = bcache_reclaim();
+        if (!buf)
+        {
+            break;
+        }
+        bcache_hash_insert(buf, lba + i);
+        buf->flags = BUF_BUSY;
+        bcache_touch(buf);
+        ata_submit_async(ATA_OP_READ, lba + i, 1, buf->data, bcache_prefetch_done, buf);
+        bcache_stats.prefetches++;
+    }
+    ata_unplug();
+}
+
+void bcache_write(uint32_t lba, uint32_t count, const void *buffer)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        buf_t *buf = bcache_getblk(lba + i);
+        memcpy(buf->data, buffer + i * SECTOR_SIZE, SECTOR_SIZE);
+        buf->flags |= BUF_VALID | BUF_DIRTY;
+        bcache_release(buf);
+    }
+    if (bcache_mode == BCACHE_WRITETHROUGH)
+    {
+        bcache_flush_range(lba, count);
+        ata_flush();
+    }
+}
+
+// waits for the blocks of a flush batch, they were marked clean as they were submitted
+void bcache_flush_wait(vec_t *dirty, vec_t *requests)
+{
+    for (uint32_t i = 0; i < dirty->size; i++)
+    {
+        buf_t *buf = (buf_t *)dirty->buffer[i];
+        if (!ata_wait((ata_request_t *)requests->buffer[i]))
+        {
+            // not on the disk, the block is written again with the next flush
+            buf->flags |= BUF_DIRTY;
+        }
+        buf->flags &= ~BUF_BUSY;
+    }
+    bcache_stats.writebacks += dirty->size;
+    dirty->size = 0;
+    requests->size = 0;
+    bcache_wakeup();
+}
+
+void bcache_sort(vec_t *list)
+{
+    for (uint32_t i = 1; i < list->size; i++)
+    {
+        uint32_t val = list->buffer[i];
+        uint32_t j = i;
+        while (j > 0 && ((buf_t *)list->buffer[j - 1])->lba > ((buf_t *)val)->lba)
+        {
+            list->buffer[j] = list->buffer[j - 1];
+            j--;
+        }
+        list->buffer[j] = val;
+    }
+}
+
+// writes back the dirty blocks in [lba, lba + count)
+void bcache_flush_range(uint32_t lba, uint32_t count)
+{
+    vec_t dirty = vec_new();
+    for (uint32_t i = 0; i < bcache_capacity; i++)
+    {
+        buf_t *buf = &bcache_pool[i];
+        if ((buf->flags & BUF_DIRTY) && !(buf->flags & (BUF_BUSY | BUF_JOURNAL)) && buf->lba - lba < count)
+        {
+            // a holder may change the block while it is written, dirtying it again keeps it
+            // for the next flush
+            buf->flags = (buf->flags | BUF_BUSY) & ~BUF_DIRTY;
+            vec_push(&dirty, (uint32_t)buf);
+        }
+    }
+    // submitted in ascending order, so each batch holds runs the disk queue can merge
+    bcache_sort(&dirty);
+    vec_t batch = vec_new();
+    vec_t requests = vec_new();
+    ata_plug();
+    for (uint32_t i = 0; i < dirty.size; i++)
+    {
+        buf_t *buf = (buf_t *)dirty.buffer[i];
+        vec_push(&batch, (uint32_t)buf);
+        vec_push(&requests, (uint32_t)ata_submit(ATA_OP_WRITE, buf->lba, 1, buf->data));
+        if (batch.size == BCACHE_FLUSH_BATCH || i + 1 == dirty.size)
+        {
+            ata_unplug();
+            bcache_flush_wait(&batch, &requests);
+            ata_plug();
+        }
+    }
+    ata_unplug();
+    vec_free(&requests);
+    vec_free(&batch);
+    vec_free(&dirty);
+}
+
+void bcache_flush()
+{
+    bcache_flush_range(0, BCACHE_NOLBA);
+}
+
+// unlike a flush, returns only once the blocks are on the media
+void bcache_sync()
+{
+    bcache_flush();
+    ata_flush();
+}
+
+void bcache_tick()
+{
+    if (++bcache_ticks >= BCACHE_FLUSH_TICKS && bcache_flusher_task)
+    {
+        task_t *task = bcache_flusher_task;
+        bcache_flusher_task = NULL;
+        bcache_ticks = 0;
+        task_awake(task);
+    }
+}
+
+// sleeps until the next flush interval, for the task that writes back periodically
+void bcache_idle()
+{
+    bcache_flusher_task = task_curtask();
+    task_sleep();
+}
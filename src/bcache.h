@@ -0,0 +1,56 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <ata.h>
+
+#define BCACHE_DEFAULT_CAPACITY 1024
+#define BCACHE_FLUSH_TICKS 300
+
+#define BCACHE_WRITEBACK 0
+#define BCACHE_WRITETHROUGH 1
+
+#define BUF_VALID 0x1
+#define BUF_DIRTY 0x2
+#define BUF_BUSY 0x4
+#define BUF_JOURNAL 0x8 // in the running journal transaction, not to be written back yet
+
+typedef struct buf_t buf_t;
+
+struct buf_t
+{
+    uint32_t lba;
+    uint32_t refs;
+    uint8_t flags;
+    char *data;
+    buf_t *hnext;
+    buf_t *prev; // lru, head is the most recently used
+    buf_t *next;
+};
+
+typedef struct
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t writebacks;
+    uint32_t evictions;
+    uint32_t prefetches; // blocks read ahead of a request
+} bcache_stats_t;
+
+extern bcache_stats_t bcache_stats;
+
+void bcache_init(uint32_t capacity, uint8_t mode);
+buf_t *bcache_get(uint32_t lba);
+buf_t *bcache_getblk(uint32_t lba);
+void bcache_release(buf_t *buf);
+void bcache_dirty(buf_t *buf);
+void bcache_read(uint32_t lba, uint32_t count, void *buffer);
+void bcache_write(uint32_t lba, uint32_t count, const void *buffer);
+void bcache_prefetch(uint32_t lba, uint32_t count);
+void bcache_flush();
+void bcache_flush_range(uint32_t lba, uint32_t count);
+void bcache_sync();
+void bcache_tick();
+void bcache_idle();
+
+#endif
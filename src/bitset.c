@@ -2,40 +2,50 @@
 
 void bitset_init(bitset_t *bs, void *start, uint32_t len)
 {
-    bs->start = (uint8_t *)start;
+    bs->start = (uint32_t *)start;
     bs->len = len;
-    for (uint32_t i = 0; i < len / 8; i++)
+    bs->hint = 0;
+    for (uint32_t i = 0; i < (len + 31) / 32; i++)
     {
-        bs->start[i] = 0x00;
+        bs->start[i] = 0x0;
     }
 }
 
 uint8_t bitset_get(bitset_t *bs, uint32_t index)
 {
-    return ((bs->start)[index / 8] & (0x80 >> (index % 8))) ? 1 : 0;
+    return ((bs->start)[index / 32] & (1u << (index % 32))) ? 1 : 0;
 }
 
 void bitset_set(bitset_t *bs, uint32_t index, uint8_t val)
 {
-    bs->start[index / 8] |= ((val * 0x80) >> (index % 8));
+    if (val)
+    {
+        bs->start[index / 32] |= 1u << (index % 32);
+    }
+    else
+    {
+        bs->start[index / 32] &= ~(1u << (index % 32));
+        if (index / 32 < bs->hint)
+        {
+            bs->hint = index / 32;
+        }
+    }
 }
 
+// a word at a time from the hint, which moves past the words found full so that the set bits
+// at the start aren't scanned again
 int32_t bitset_first_unset(bitset_t *bs)
 {
-    for (uint32_t i = 0; i < bs->len / 8; i++)
+    for (uint32_t i = bs->hint; i < (bs->len + 31) / 32; i++)
     {
-        if (bs->start[i] == 0xff)
+        if (bs->start[i] == 0xffffffff)
         {
             continue;
         }
-        for (uint32_t j = 0; j < 8; j++)
-        {
-            uint32_t idx = i * 8 + j;
-            if (!bitset_get(bs, idx))
-            {
-                return idx;
-            }
-        }
+        bs->hint = i;
+        uint32_t idx = i * 32 + __builtin_ctz(~bs->start[i]);
+        return idx < bs->len ? (int32_t)idx : -1;
     }
+    bs->hint = (bs->len + 31) / 32;
     return -1;
 }
\ No newline at end of file
@@ -5,8 +5,9 @@
 
 typedef struct
 {
-    uint8_t *start;
+    uint32_t *start;
     uint32_t len;
+    uint32_t hint; // no word before this one has an unset bit
 } bitset_t;
 
 void bitset_init(bitset_t *bs, void *start, uint32_t len);
@@ -86,13 +86,13 @@ void fd_table_close(fd_table* table, uint32_t fd_id)
         {
             if(pipe_close_rd(fd->ptr) && fd->kind != FD_KIND_MQ)
             {
-                kfree(fd->ptr);
+                pipe_free(fd->ptr);
             }
         }
         else{
             if(pipe_close_wr(fd->ptr) && fd->kind != FD_KIND_MQ)
             {
-                kfree(fd->ptr);
+                pipe_free(fd->ptr);
             }
         }
     }
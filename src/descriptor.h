@@ -13,6 +13,14 @@
 #define FD_KIND_PIPE 6
 #define FD_KIND_MQ 7
 
+// sequential read detection of an open disk file
+typedef struct
+{
+    uint32_t next;   // the offset a sequential read continues from
+    uint32_t window; // in sectors, 0 while the reads aren't sequential
+    uint32_t end;    // the file sector read-ahead got up to
+} readahead_t;
+
 typedef struct
 {
     uint32_t kind;
@@ -20,6 +28,7 @@ typedef struct
     uint8_t isopen;
     uint8_t access;
     void *ptr;
+    readahead_t ra;
 } fd_t;
 
 typedef struct
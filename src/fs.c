@@ -1,64 +1,398 @@
 #include <fs.h>
 #include <kutil.h>
+#include <journal.h>
+#include <asm.h>
+#include <mmap.h>
+#include <slab.h>
 
-lba28_t balloc_ptr;
-vec_t inodelist;
+#define DCACHE_BUCKETS 256
+#define WBUF_SECTORS 8 // small appends to a file are gathered up to this many sectors
+#define WBUF_SIZE (WBUF_SECTORS * SECTOR_SIZE)
+#define WBUF_MAX 16 // files holding gathered appends, past this the oldest one is written back
+#define READAHEAD_MIN 8 // in sectors
+#define READAHEAD_MAX 128
+#define DCACHE_BUDGET 0x10000 // bytes of cached nodes before unreferenced ones are reclaimed
+
+slab_cache_t inode_cache = SLAB_CACHE(SECTOR_SIZE); // a node is written out whole as its header sector
+inode_t *fs_root;
+inode_t *dcache_table[DCACHE_BUCKETS];
+inode_t *dcache_head = NULL; // lru of the unreferenced nodes, head is the most recently used
+inode_t *dcache_tail = NULL;
+dcache_stats_t dcache_stats;
+inode_t *wbuf_head = NULL; // nodes holding gathered appends, oldest first
+uint32_t wbuf_count = 0;
 krwlock balloc_lock;
+balloc_header_t balloc_header;
+uint32_t *balloc_map;     // in-memory copy of the on-disk bitmap, a set bit is a used sector
+uint32_t *balloc_summary; // a set bit marks a full word of the bitmap
+// freed sectors stay used in balloc_map until no transaction in the journal can be replayed over
+// them: pending ones were freed by the running transaction, released ones by a committed one
+uint32_t *balloc_pending;
+uint32_t *balloc_released;
+uint8_t balloc_pending_any = 0;
+uint8_t balloc_header_dirty = 0; // the cursor or the size changed since the header was last written
+uint8_t balloc_released_any = 0;
+uint32_t balloc_words;
 
 #define MAX_NODE_NAME_LENGTH 256
 #define BALLOC_SECTOR 0
 #define ROOT_INDEX_SECTOR 1
-#define FS_START_SECTOR 2
+#define BITMAP_START_SECTOR 2
+#define BITS_PER_SECTOR (SECTOR_SIZE * 8)
+#define REALLOC_CHUNK_SECTORS 128
+#define INODE_GROW_MAX 1024 // in sectors, the most a file is grown ahead of its size
+#define BALLOC_NONE 0xffffffff
+#define FS_TX_METADATA 16 // blocks an operation dirties besides the bitmap: inodes, records, index slots, the header
+
+uint8_t balloc_bit(uint32_t sector)
+{
+    return (balloc_map[sector / 32] >> (sector % 32)) & 1;
+}
+
+void balloc_summary_update(uint32_t word)
+{
+    if (balloc_map[word] == 0xffffffff)
+    {
+        balloc_summary[word / 32] |= 1 << (word % 32);
+    }
+    else
+    {
+        balloc_summary[word / 32] &= ~(1 << (word % 32));
+    }
+}
+
+// writes back the bitmap sectors covering [from, from + count), pending frees are free on disk
+void balloc_map_update(lba28_t from, lba28_t count)
+{
+    uint32_t first = from / BITS_PER_SECTOR;
+    uint32_t last = (from + count - 1) / BITS_PER_SECTOR;
+    for (uint32_t sector = first; sector <= last; sector++)
+    {
+        buf_t *buf = bcache_getblk(balloc_header.bitmap_start + sector);
+        uint32_t *words = (uint32_t *)buf->data;
+        for (uint32_t i = 0; i < SECTOR_SIZE / 4; i++)
+        {
+            uint32_t word = sector * SECTOR_SIZE / 4 + i;
+            words[i] = balloc_map[word] & ~(balloc_pending[word] | balloc_released[word]);
+        }
+        journal_dirty(buf);
+        bcache_release(buf);
+    }
+}
+
+void balloc_mark(lba28_t from, lba28_t count, uint8_t used)
+{
+    for (uint32_t i = from; i < from + count; i++)
+    {
+        if (used)
+        {
+            balloc_map[i / 32] |= 1 << (i % 32);
+        }
+        else
+        {
+            balloc_map[i / 32] &= ~(1 << (i % 32));
+        }
+        if (i % 32 == 31 || i == from + count - 1)
+        {
+            balloc_summary_update(i / 32);
+        }
+    }
+    balloc_map_update(from, count);
+}
 
-void binit()
+// the first free sector at or after the given one, full words are skipped through the summary
+uint32_t balloc_next_free(uint32_t sector)
 {
+    if (sector >= balloc_header.sectors)
+    {
+        return BALLOC_NONE;
+    }
+    uint32_t word = sector / 32;
+    uint32_t free = ~balloc_map[word] & (0xffffffff << (sector % 32));
+    if (!free)
+    {
+        word++;
+        uint32_t group = word / 32;
+        uint32_t groups = (balloc_words + 31) / 32;
+        uint32_t candidates = group < groups ? ~balloc_summary[group] & (0xffffffff << (word % 32)) : 0;
+        while (!candidates)
+        {
+            if (++group >= groups)
+            {
+                return BALLOC_NONE;
+            }
+            candidates = ~balloc_summary[group];
+        }
+        word = group * 32 + __builtin_ctz(candidates);
+        if (word >= balloc_words)
+        {
+            return BALLOC_NONE;
+        }
+        free = ~balloc_map[word];
+    }
+    sector = word * 32 + __builtin_ctz(free);
+    return sector < balloc_header.sectors ? sector : BALLOC_NONE;
+}
+
+// the number of free sectors starting at the given one, counting stops at max
+uint32_t balloc_run_length(uint32_t sector, uint32_t max)
+{
+    uint32_t len = 0;
+    while (len < max && sector + len < balloc_header.sectors)
+    {
+        uint32_t i = sector + len;
+        if (i % 32 == 0 && balloc_map[i / 32] == 0 && max - len >= 32)
+        {
+            len += 32;
+        }
+        else if (!balloc_bit(i))
+        {
+            len++;
+        }
+        else
+        {
+            break;
+        }
+    }
+    return min(len, balloc_header.sectors - sector);
+}
 
+// next fit: the first run of free sectors large enough, looking from the cursor onwards
+uint32_t balloc_find(uint32_t count)
+{
+    uint32_t from = balloc_header.cursor;
+    uint8_t wrapped = 0;
+    while (1)
+    {
+        uint32_t sector = balloc_next_free(from);
+        if (wrapped && (sector == BALLOC_NONE || sector >= balloc_header.cursor))
+        {
+            return BALLOC_NONE;
+        }
+        if (sector == BALLOC_NONE)
+        {
+            wrapped = 1;
+            from = 0;
+            continue;
+        }
+        uint32_t len = balloc_run_length(sector, count);
+        if (len >= count)
+        {
+            return sector;
+        }
+        from = sector + len;
+    }
+}
+
+// where the next fit search carries on after an unclean shutdown: past the last used sector
+uint32_t balloc_scan_cursor()
+{
+    uint32_t word = balloc_words;
+    while (word && !balloc_map[word - 1])
+    {
+        word--;
+    }
+    if (!word)
+    {
+        return balloc_header.bitmap_start + balloc_header.bitmap_sectors;
+    }
+    uint32_t sector = word * 32 - __builtin_clz(balloc_map[word - 1]);
+    return sector < balloc_header.sectors ? sector : balloc_header.bitmap_start + balloc_header.bitmap_sectors;
+}
+
+void binit(uint8_t sync)
+{
     balloc_fetch();
-    if (balloc_ptr == 0)
+    if (balloc_header.magic != BALLOC_MAGIC)
     {
-        balloc_ptr = FS_START_SECTOR;
+        if (balloc_header.cursor)
+        {
+            kpanic("disk image predates the free space bitmap, regenerate it with fsgen.js");
+        }
+        // an empty disk, sized by what the drive reports
+        if (!ata_sectors())
+        {
+            kpanic("the disk didn't report its size");
+        }
+        balloc_header.magic = BALLOC_MAGIC;
+        balloc_header.sectors = ata_sectors();
+        balloc_header.bitmap_start = BITMAP_START_SECTOR;
+        balloc_header.bitmap_sectors = (balloc_header.sectors + BITS_PER_SECTOR - 1) / BITS_PER_SECTOR;
+        balloc_header.cursor = balloc_header.bitmap_start + balloc_header.bitmap_sectors;
+        balloc_header.journal_start = 0;
+        balloc_header.journal_sectors = 0;
+    }
+    else if (balloc_header.journal_sectors)
+    {
+        // the header and the bitmap may be among the blocks replayed
+        journal_replay(balloc_header.journal_start, balloc_header.journal_sectors);
+        balloc_fetch();
+    }
+    if (ata_sectors() && ata_sectors() < balloc_header.sectors)
+    {
+        // an image made for a larger disk, nothing past the end of this one may be handed out
+        kprintf("KERNEL : the disk has %u sectors, not %u\n", ata_sectors(), balloc_header.sectors);
+        balloc_header.sectors = ata_sectors();
+        balloc_header_dirty = 1;
+    }
+
+    balloc_words = balloc_header.bitmap_sectors * SECTOR_SIZE / 4;
+    balloc_map = kmalloc(balloc_header.bitmap_sectors * SECTOR_SIZE);
+    balloc_pending = kmalloc(balloc_header.bitmap_sectors * SECTOR_SIZE);
+    memset(balloc_pending, 0, balloc_header.bitmap_sectors * SECTOR_SIZE);
+    balloc_released = kmalloc(balloc_header.bitmap_sectors * SECTOR_SIZE);
+    memset(balloc_released, 0, balloc_header.bitmap_sectors * SECTOR_SIZE);
+    balloc_summary = kmalloc((balloc_words + 31) / 32 * 4);
+    memset(balloc_summary, 0, (balloc_words + 31) / 32 * 4);
+    bcache_read(balloc_header.bitmap_start, balloc_header.bitmap_sectors, balloc_map);
+    for (uint32_t i = 0; i < balloc_words; i++)
+    {
+        balloc_summary_update(i);
+    }
+    // the cursor is written only on sync, the one on disk is stale if anything was replayed
+    if (journal_stats.replayed || balloc_header.cursor >= balloc_header.sectors)
+    {
+        balloc_header.cursor = balloc_scan_cursor();
+    }
+
+    if (!balloc_bit(0))
+    {
+        // the header, the root index and the bitmap itself are never handed out
+        balloc_mark(0, balloc_header.bitmap_start + balloc_header.bitmap_sectors, 1);
+        balloc_update();
+    }
+    if (!balloc_header.journal_sectors)
+    {
+        balloc_header.journal_start = balloc(JOURNAL_SECTORS);
+        balloc_header.journal_sectors = JOURNAL_SECTORS;
         balloc_update();
     }
+    // nothing may depend on the journal before the blocks written so far are home
+    bcache_sync();
+    journal_init(balloc_header.journal_start, balloc_header.journal_sectors, sync,
+                 balloc_header.bitmap_sectors + FS_TX_METADATA, balloc_commit, balloc_checkpoint);
 }
 
-void balloc_update()
+// writes the header if the cursor moved, it is only a hint and the bitmap is what the allocator trusts
+void balloc_persist()
 {
     krwlock_write(&balloc_lock);
-    char *_balloc_ptr_temp = kmalloc(SECTOR_SIZE);
-    *(uint32_t *)_balloc_ptr_temp = balloc_ptr;
-    ata_write(BALLOC_SECTOR, _balloc_ptr_temp);
-    kfree(_balloc_ptr_temp);
+    if (balloc_header_dirty)
+    {
+        balloc_update();
+    }
     krwlock_release(&balloc_lock);
 }
+
+void balloc_update()
+{
+    buf_t *buf = bcache_getblk(BALLOC_SECTOR);
+    memset(buf->data, 0, SECTOR_SIZE);
+    memcpy(buf->data, &balloc_header, sizeof(balloc_header_t));
+    journal_dirty(buf);
+    bcache_release(buf);
+    balloc_header_dirty = 0;
+}
 void balloc_fetch()
 {
-    krwlock_read(&balloc_lock);
-    char *_balloc_ptr_temp = kmalloc(SECTOR_SIZE);
-    ata_read(BALLOC_SECTOR, _balloc_ptr_temp);
-    balloc_ptr = *(uint32_t *)_balloc_ptr_temp;
-    kfree(_balloc_ptr_temp);
+    char *_balloc_header_temp = kmalloc(SECTOR_SIZE);
+    bcache_read(BALLOC_SECTOR, 1, _balloc_header_temp);
+    memcpy(&balloc_header, _balloc_header_temp, sizeof(balloc_header_t));
+    kfree(_balloc_header_temp);
+}
+
+// returns 0 if there is no free run large enough, sector 0 is never handed out
+lba28_t balloc_try(lba28_t size)
+{
+    krwlock_write(&balloc_lock);
+    uint32_t ptr = balloc_find(size);
+    if (ptr == BALLOC_NONE)
+    {
+        krwlock_release(&balloc_lock);
+        return 0;
+    }
+    balloc_mark(ptr, size, 1);
+    balloc_header.cursor = ptr + size;
+    balloc_header_dirty = 1;
     krwlock_release(&balloc_lock);
+    return ptr;
 }
 
 lba28_t balloc(lba28_t size)
 {
-    lba28_t ptr = balloc_ptr;
-    balloc_ptr += size;
-    balloc_update();
+    lba28_t ptr = balloc_try(size);
+    if (!ptr)
+    {
+        kpanic("disk is full, can't allocate %u sectors", size);
+    }
     return ptr;
 }
 
-void bfree(__attribute__((unused)) lba28_t address)
+void bfree(lba28_t address, lba28_t size)
+{
+    if (!size)
+    {
+        return;
+    }
+    krwlock_write(&balloc_lock);
+    for (uint32_t i = address; i < address + size; i++)
+    {
+        balloc_pending[i / 32] |= 1 << (i % 32);
+    }
+    balloc_pending_any = 1;
+    balloc_map_update(address, size);
+    krwlock_release(&balloc_lock);
+}
+
+void balloc_commit()
 {
+    if (!balloc_pending_any)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < balloc_words; i++)
+    {
+        balloc_released[i] |= balloc_pending[i];
+        balloc_pending[i] = 0;
+    }
+    balloc_pending_any = 0;
+    balloc_released_any = 1;
+}
+
+void balloc_checkpoint()
+{
+    if (!balloc_released_any)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < balloc_words; i++)
+    {
+        if (balloc_released[i])
+        {
+            balloc_map[i] &= ~balloc_released[i];
+            balloc_released[i] = 0;
+            balloc_summary_update(i);
+        }
+    }
+    balloc_released_any = 0;
 }
 
-lba28_t brealloc(lba28_t address, lba28_t size)
+// grows the run at address in place if the sectors right after it are free
+uint8_t bextend(lba28_t address, lba28_t size, lba28_t new_size)
 {
-    bfree(address);
-    return balloc(size);
+    uint8_t extended = 0;
+    krwlock_write(&balloc_lock);
+    uint32_t extra = new_size - size;
+    if (balloc_run_length(address + size, extra) >= extra)
+    {
+        balloc_mark(address + size, extra, 1);
+        extended = 1;
+    }
+    krwlock_release(&balloc_lock);
+    return extended;
 }
 
-void inode_create(uint8_t dir, inode_t *parent, const char *name, inode_t *node, inode_t *gparent)
+void inode_create(uint8_t dir, inode_t *parent, const char *name, inode_t *node)
 {
     if (strlen(name) > MAX_NODE_NAME_LENGTH)
     {
@@ -67,6 +401,10 @@ void inode_create(uint8_t dir, inode_t *parent, const char *name, inode_t *node,
 
     node->type = dir ? inode_type_dir : inode_type_file;
     node->alloc = 0;
+    node->extent_count = 0;
+    node->dir_index = 0;
+    node->dir_index_sectors = 0;
+    node->dir_index_used = 0;
     node->size = 0;
     node->child_count = 0;
     node->index = balloc(1);
@@ -78,26 +416,34 @@ void inode_create(uint8_t dir, inode_t *parent, const char *name, inode_t *node,
     op.name1 = name;
     op.index = node->index;
 
-    inode_child_set(parent, op, gparent);
+    inode_child_set(parent, op);
 }
 void inode_delete(inode_t *node, inode_t *parent)
 {
     node->isvalid = 0;
-    ata_write(node->index, node);
+    inode_update(node);
+    inode_free_extents(node);
+    if (node->dir_index)
+    {
+        bfree(node->dir_index, node->dir_index_sectors);
+    }
+    bfree(node->index, 1);
+    inode_wbuf_drop(node);
     child_operation op;
     op.op = CHOP_REM;
-    op.name1 = (const char *)node->_pathbuf.fields.buffer[node->_pathbuf.fields.size];
+    op.name1 = pathbuf_name(&node->_pathbuf);
     if (parent)
     {
-        inode_child_set(parent, op, NULL);
+        inode_child_set(parent, op);
     }
 }
-void inode_write(inode_t *node, uint32_t from, const char *buffer, uint32_t count, inode_t *parent)
+void inode_write(inode_t *node, uint32_t from, const char *buffer, uint32_t count)
 {
-    if (!count)
+    if (!count || inode_wbuf_append(node, from, buffer, count))
     {
         return;
     }
+    inode_wbuf_flush(node);
     operation_bounds op;
     op.bytes_from = from;
     op.bytes_count = count;
@@ -105,36 +451,27 @@ void inode_write(inode_t *node, uint32_t from, const char *buffer, uint32_t coun
 
     if (op.sec_overflow)
     {
-        inode_realloc(node, op.sec_overflow + node->alloc, parent);
-        inode_calculate_operation_bounds(node, &op);
+        inode_realloc(node, op.sec_overflow + node->alloc);
     }
 
+    uint32_t size = node->size;
     if (op.bytes_overflow)
     {
         node->size += op.bytes_overflow;
         inode_update(node);
     }
-    char *blocks = kmalloc(SECTOR_SIZE * op.sec_count);
-    for (lba28_t i = 0; i < op.sec_read; i++)
-    {
-        ata_read(op.sec_from + i, blocks + i * SECTOR_SIZE);
-    }
-    memcpy(blocks + (from % 512), buffer, count);
-    for (lba28_t i = 0; i < op.sec_count; i++)
-    {
-        ata_write(op.sec_from + i, blocks + i * SECTOR_SIZE);
-    }
-    kfree(blocks);
+    inode_copy(node, from, (char *)buffer, count, size, 1);
 }
 void inode_truncate(inode_t *node)
 {
-    node->alloc = 0;
+    inode_wbuf_drop(node);
+    inode_free_extents(node);
     node->size = 0;
     inode_update(node);
 }
 uint32_t inode_read(inode_t *node, uint32_t from, char *buffer, uint32_t count)
 {
-    if (!count)
+    if (!count || from >= node->size)
     {
         return 0;
     }
@@ -142,41 +479,35 @@ uint32_t inode_read(inode_t *node, uint32_t from, char *buffer, uint32_t count)
     op.bytes_from = from;
     op.bytes_count = count;
     inode_calculate_operation_bounds(node, &op);
-
-    char *blocks = kmalloc(op.sec_read * SECTOR_SIZE);
-    for (lba28_t i = 0; i < op.sec_read; i++)
-    {
-        ata_read(op.sec_from + i, blocks + i * SECTOR_SIZE);
-    }
-
-    memcpy(buffer, blocks + (from % 512), op.bytes_read);
-    kfree(blocks);
+    inode_copy(node, from, buffer, op.bytes_read, node->size, 0);
     return op.bytes_read;
 }
 uint32_t inode_readdir(inode_t *node, uint32_t from, char *buffer)
 {
-    if (from == node->size)
+    uint32_t sector = from / SECTOR_SIZE;
+    uint32_t offset = from % SECTOR_SIZE;
+    for (; sector < node->size / SECTOR_SIZE; sector++, offset = 0)
     {
-        return 0;
+        buf_t *buf = childtable_sector(node, sector);
+        while (offset < SECTOR_SIZE)
+        {
+            dirent_t *rec = (dirent_t *)(buf->data + offset);
+            offset += rec->rec_len;
+            if (rec->index)
+            {
+                memcpy(buffer, rec->name, rec->name_len + 1);
+                bcache_release(buf);
+                return sector * SECTOR_SIZE + offset - from;
+            }
+        }
+        bcache_release(buf);
     }
-    char *dir = kmalloc(node->size - from);
-    inode_read(node, from, dir, node->size - from);
-    uint32_t dirlen = strlen(dir);
-    strcpy(buffer, dir);
-    uint32_t len = dirlen + 5;
-    buffer[dirlen] = 0;
-    kfree(dir);
-    return len;
+    return 0;
 }
 
 void inode_child(inode_t *node, const char *name, inode_t *buffer)
 {
-    childtable_t table;
-    table.ptr = kmalloc(max(1, node->alloc) * SECTOR_SIZE);
-    table.sectors = node->alloc;
-    table.size = node->size;
-    inode_read(node, 0, (char *)table.ptr, node->size);
-    lba28_t child_index = childtable_get(&table, name);
+    lba28_t child_index = childtable_get(node, name);
     if (child_index != 0)
     {
         inode_fetch(child_index, buffer);
@@ -185,55 +516,125 @@ void inode_child(inode_t *node, const char *name, inode_t *buffer)
     {
         buffer->isvalid = 0;
     }
-    kfree(table.ptr);
 }
-void inode_child_set(inode_t *node, child_operation op, inode_t *parent)
+void inode_child_set(inode_t *node, child_operation op)
 {
-    childtable_t table;
-    table.ptr = kmalloc(max(node->alloc, 1) * SECTOR_SIZE);
-    table.size = node->size;
-    table.sectors = node->alloc;
-
-    inode_read(node, 0, (char *)table.ptr, node->size);
-
     if (op.op == CHOP_ADD)
     {
         node->child_count++;
-        childtable_add(&table, op.name1, op.index);
+        childtable_add(node, op.name1, op.index);
     }
     else if (op.op == CHOP_REM)
     {
         node->child_count--;
-        childtable_remove(&table, op.name1);
+        childtable_remove(node, op.name1);
     }
     else if (op.op == CHOP_RENAME)
     {
-        childtable_edit_name(&table, op.name1, op.name2);
+        childtable_edit_name(node, op.name1, op.name2);
     }
-    else if (op.op == CHOP_RELOC)
+    else
     {
-        childtable_edit_index(&table, op.name1, op.index);
+        childtable_remove(node, op.name1);
     }
-    else
+    inode_update(node);
+}
+// writes back the oldest buffered appends that nobody is working on, 0 if every such node is busy
+uint8_t inode_wbuf_reclaim()
+{
+    for (inode_t *node = wbuf_head; node; node = node->_wbuf_next)
     {
-        childtable_remove(&table, op.name1);
+        if (krwlock_try_write(&node->_lock))
+        {
+            inode_wbuf_flush(node);
+            krwlock_release(&node->_lock);
+            return 1;
+        }
     }
+    return 0;
+}
 
-    inode_write(node, 0, (char *)table.ptr, table.size, parent);
+// gathers a small append in memory, the sectors for it are allocated once the buffer is written back
+uint8_t inode_wbuf_append(inode_t *node, uint32_t from, const char *buffer, uint32_t count)
+{
+    if (from != node->size)
+    {
+        return 0;
+    }
+    if (node->_wbuf && from + count > node->_wbuf_sector * SECTOR_SIZE + WBUF_SIZE)
+    {
+        inode_wbuf_flush(node);
+    }
+    if (!node->_wbuf)
+    {
+        if (from % SECTOR_SIZE + count > WBUF_SIZE || (wbuf_count == WBUF_MAX && !inode_wbuf_reclaim()))
+        {
+            return 0;
+        }
+        node->_wbuf = kmalloc(WBUF_SIZE);
+        node->_wbuf_sector = from / SECTOR_SIZE;
+        if (from % SECTOR_SIZE)
+        {
+            inode_io(node, node->_wbuf_sector, 1, node->_wbuf, 0);
+        }
+        inode_t **ptr = &wbuf_head;
+        while (*ptr)
+        {
+            ptr = &(*ptr)->_wbuf_next;
+        }
+        *ptr = node;
+        node->_wbuf_next = NULL;
+        wbuf_count++;
+    }
+    memcpy(node->_wbuf + from - node->_wbuf_sector * SECTOR_SIZE, buffer, count);
+    node->size += count;
+    return 1;
+}
+
+void inode_wbuf_drop(inode_t *node)
+{
+    if (!node->_wbuf)
+    {
+        return;
+    }
+    inode_t **ptr = &wbuf_head;
+    while (*ptr != node)
+    {
+        ptr = &(*ptr)->_wbuf_next;
+    }
+    *ptr = node->_wbuf_next;
+    wbuf_count--;
+    kfree(node->_wbuf);
+    node->_wbuf = NULL;
+}
+
+void inode_wbuf_flush(inode_t *node)
+{
+    if (!node->_wbuf)
+    {
+        return;
+    }
+    uint32_t sectors = (node->size - node->_wbuf_sector * SECTOR_SIZE + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if (node->_wbuf_sector + sectors > node->alloc)
+    {
+        inode_realloc(node, node->_wbuf_sector + sectors);
+    }
+    inode_io(node, node->_wbuf_sector, sectors, node->_wbuf, 1);
     inode_update(node);
-    kfree(table.ptr);
+    inode_wbuf_drop(node);
 }
+
 void inode_calculate_operation_bounds(inode_t *node, operation_bounds *operation)
 {
     uint32_t bytes_to = operation->bytes_from + operation->bytes_count;
-    operation->sec_from = node->index + 1 + operation->bytes_from / SECTOR_SIZE;
-    lba28_t sec_to = node->index + 1 + ((bytes_to - 1) / SECTOR_SIZE) + 1;
+    operation->sec_from = operation->bytes_from / SECTOR_SIZE;
+    lba28_t sec_to = ((bytes_to - 1) / SECTOR_SIZE) + 1;
     operation->sec_count = sec_to - operation->sec_from;
 
-    if (sec_to > node->index + 1 + node->alloc)
+    if (sec_to > node->alloc)
     {
-        operation->sec_overflow = sec_to - (node->index + 1 + node->alloc);
-        operation->sec_read = (node->index + 1 + node->alloc) - operation->sec_from;
+        operation->sec_overflow = sec_to - node->alloc;
+        operation->sec_read = node->alloc > operation->sec_from ? node->alloc - operation->sec_from : 0;
     }
     else
     {
@@ -252,180 +653,671 @@ void inode_calculate_operation_bounds(inode_t *node, operation_bounds *operation
         operation->bytes_read = operation->bytes_count;
     }
 }
-void inode_realloc(inode_t *node, uint32_t sectors, inode_t *parent)
+// moves the data into a single run, for when the extent list is full
+void inode_compact(inode_t *node, uint32_t sectors)
 {
-    lba28_t new_index = brealloc(node->index, sectors + 1);
-    char *buffer = kmalloc(SECTOR_SIZE);
-    for(uint32_t i=0;i<node->alloc;i++)
+    lba28_t new_start = balloc(sectors);
+    char *buffer = kmalloc(REALLOC_CHUNK_SECTORS * SECTOR_SIZE);
+    for (uint32_t i = 0; i < node->alloc; i += REALLOC_CHUNK_SECTORS)
     {
-        ata_read(node->index + 1 + i,buffer);
-        ata_write(new_index + 1 + i,buffer);
+        uint32_t count = min(REALLOC_CHUNK_SECTORS, node->alloc - i);
+        inode_io(node, i, count, buffer, 0);
+        bcache_write(new_start + i, count, buffer);
     }
     kfree(buffer);
-    node->index = new_index;
+    if (node->type == inode_type_dir)
+    {
+        // the run is unused until the header moving the directory to it commits, so it is written
+        // home first instead of filling the transaction
+        bcache_flush_range(new_start, node->alloc);
+    }
+    inode_free_extents(node);
+    node->extents[0].start = new_start;
+    node->extents[0].count = sectors;
+    node->extent_count = 1;
     node->alloc = sectors;
+}
+
+void inode_realloc(inode_t *node, uint32_t sectors)
+{
+    uint32_t needed = sectors - node->alloc;
+    extent_t *last = node->extent_count ? &node->extents[node->extent_count - 1] : NULL;
+    if (last && bextend(last->start, last->count, last->count + needed))
+    {
+        last->count += needed;
+        node->alloc = sectors;
+        inode_update(node);
+        return;
+    }
+    // grown files get room ahead, so appending doesn't need an extent per write
+    uint32_t want = max(needed, min(node->alloc, INODE_GROW_MAX));
+    while (node->alloc < sectors)
+    {
+        if (node->extent_count == INODE_EXTENTS)
+        {
+            inode_compact(node, max(sectors, node->alloc + want));
+            break;
+        }
+        lba28_t start = balloc_try(want);
+        if (!start)
+        {
+            if (want == 1)
+            {
+                kpanic("disk is full, can't grow a file to %u sectors", sectors);
+            }
+            want = max(want / 2, 1);
+            continue;
+        }
+        node->extents[node->extent_count].start = start;
+        node->extents[node->extent_count].count = want;
+        node->extent_count++;
+        node->alloc += want;
+        want = max(sectors - min(node->alloc, sectors), 1);
+    }
     inode_update(node);
-    if (parent) // is not root
+}
+
+// maps a file sector to its lba, count is set to the number of sectors that follow it in the same extent
+lba28_t inode_bmap(inode_t *node, uint32_t sector, uint32_t *count)
+{
+    for (uint32_t i = 0; i < node->extent_count; i++)
     {
-        child_operation op;
-        op.op = CHOP_RELOC;
-        op.name1 = (char *)pathbuf_name(&node->_pathbuf);
-        op.index = new_index;
-        inode_child_set(parent, op, NULL);
+        if (sector < node->extents[i].count)
+        {
+            *count = node->extents[i].count - sector;
+            return node->extents[i].start + sector;
+        }
+        sector -= node->extents[i].count;
     }
-    else // is root
+    kpanic("sector %u is out of the extents of inode %u", sector, node->index);
+    return 0;
+}
+
+void inode_io(inode_t *node, uint32_t sector, uint32_t count, char *buffer, uint8_t write)
+{
+    while (count)
     {
-        char *root_index = kmalloc(SECTOR_SIZE);
-        *(uint32_t *)root_index = node->index;
-        ata_write(1, root_index);
-        kfree(root_index);
+        uint32_t run;
+        lba28_t lba = inode_bmap(node, sector, &run);
+        run = min(run, count);
+        if (write)
+        {
+            bcache_write(lba, run, buffer);
+        }
+        else
+        {
+            bcache_read(lba, run, buffer);
+        }
+        sector += run;
+        buffer += run * SECTOR_SIZE;
+        count -= run;
     }
 }
 
-void inode_fetch(_unused lba28_t index, _unused inode_t *node)
+// moves bytes between a file and memory, whole sectors straight through the cache and only the
+// partial ones at the ends a block at a time. size is where the file's data ended before a write,
+// a partial sector past it isn't read in
+void inode_copy(inode_t *node, uint32_t from, char *buffer, uint32_t count, uint32_t size, uint8_t write)
 {
-    inode_t *buffer = kmalloc(SECTOR_SIZE);
-    ata_read(index, buffer);
-    node->isvalid = buffer->isvalid;
-    node->alloc = buffer->alloc;
-    node->size = buffer->size;
-    node->child_count = buffer->child_count;
-    node->type = buffer->type;
-    node->index = buffer->index;
-    kfree(buffer);
+    while (count)
+    {
+        uint32_t sector = from / SECTOR_SIZE;
+        uint32_t offset = from % SECTOR_SIZE;
+        uint32_t run;
+        lba28_t lba = inode_bmap(node, sector, &run);
+        uint32_t len;
+        if (!offset && count >= SECTOR_SIZE)
+        {
+            run = min(run, count / SECTOR_SIZE);
+            len = run * SECTOR_SIZE;
+            if (write)
+            {
+                bcache_write(lba, run, buffer);
+            }
+            else
+            {
+                bcache_read(lba, run, buffer);
+            }
+        }
+        else
+        {
+            len = min(count, SECTOR_SIZE - offset);
+            if (write)
+            {
+                buf_t *buf = sector * SECTOR_SIZE < size ? bcache_get(lba) : bcache_getblk(lba);
+                if (!(buf->flags & BUF_VALID))
+                {
+                    // a recycled block still holds another sector, none of it may reach the disk
+                    memset(buf->data, 0, offset);
+                    memset(buf->data + offset + len, 0, SECTOR_SIZE - offset - len);
+                }
+                memcpy(buf->data + offset, buffer, len);
+                bcache_dirty(buf);
+                bcache_release(buf);
+            }
+            else
+            {
+                buf_t *buf = bcache_get(lba);
+                memcpy(buffer, buf->data + offset, len);
+                bcache_release(buf);
+            }
+        }
+        from += len;
+        buffer += len;
+        count -= len;
+    }
+}
+
+void inode_free_extents(inode_t *node)
+{
+    for (uint32_t i = 0; i < node->extent_count; i++)
+    {
+        bfree(node->extents[i].start, node->extents[i].count);
+    }
+    node->extent_count = 0;
+    node->alloc = 0;
+}
+
+void inode_fetch(lba28_t index, inode_t *node)
+{
+    buf_t *buf = bcache_get(index);
+    memcpy(node, buf->data, INODE_DISK_SIZE);
+    bcache_release(buf);
 }
 void inode_update(inode_t *node)
 {
-    ata_write(node->index, node);
+    journal_write(node->index, node);
 }
 inode_t *inode_new(pathbuf_t pathbuf)
 {
-    inode_t *node = kmalloc(SECTOR_SIZE);
+    inode_t *node = slab_alloc(&inode_cache);
     node->_refs = 1;
     node->_parent = NULL;
+    node->_dir_hint = 0;
     node->_pathbuf = pathbuf;
-    inodelist_add(node);
+    node->_hash = 0;
+    node->_hnext = NULL;
+    node->_wbuf = NULL;
     krwlock_init(&node->_lock);
     return node;
 }
 
-inode_t *inodelist_get(pathbuf_t *pathbuf)
+// the heap memory a cached node keeps, its header sector buffer and its path
+uint32_t dcache_footprint(inode_t *node)
 {
-    for (uint32_t i = 0; i < inodelist.size; i++)
+    uint32_t bytes = SECTOR_SIZE + node->_pathbuf.fields.cap * sizeof(uint32_t);
+    for (uint32_t i = 0; i < node->_pathbuf.fields.size; i++)
     {
-        inode_t *node = (inode_t *)inodelist.buffer[i];
-        if (pathbuf_cmp(&node->_pathbuf, pathbuf))
-        {
-            return node;
-        }
+        bytes += strlen((char *)node->_pathbuf.fields.buffer[i]) + 1;
+    }
+    return bytes;
+}
+
+uint32_t dcache_bucket(inode_t *parent, uint32_t hash)
+{
+    return (hash ^ ((uint32_t)parent >> 4)) % DCACHE_BUCKETS;
+}
+
+inode_t *dcache_lookup(inode_t *parent, const char *name, uint32_t hash)
+{
+    inode_t *node = dcache_table[dcache_bucket(parent, hash)];
+    while (node && (node->_parent != parent || node->_hash != hash || strcmp(pathbuf_name(&node->_pathbuf), name) != 0))
+    {
+        node = node->_hnext;
+    }
+    return node;
+}
+
+void dcache_insert(inode_t *node)
+{
+    uint32_t bucket = dcache_bucket(node->_parent, node->_hash);
+    node->_hnext = dcache_table[bucket];
+    dcache_table[bucket] = node;
+    dcache_stats.resident += dcache_footprint(node);
+}
+
+void dcache_remove(inode_t *node)
+{
+    inode_t **ptr = &dcache_table[dcache_bucket(node->_parent, node->_hash)];
+    while (*ptr != node)
+    {
+        ptr = &(*ptr)->_hnext;
+    }
+    *ptr = node->_hnext;
+    node->_hnext = NULL;
+    dcache_stats.resident -= dcache_footprint(node);
+}
+
+void dcache_lru_remove(inode_t *node)
+{
+    if (node->_lru_prev)
+    {
+        node->_lru_prev->_lru_next = node->_lru_next;
+    }
+    else
+    {
+        dcache_head = node->_lru_next;
+    }
+    if (node->_lru_next)
+    {
+        node->_lru_next->_lru_prev = node->_lru_prev;
+    }
+    else
+    {
+        dcache_tail = node->_lru_prev;
     }
-    return NULL;
 }
 
-void inodelist_add(inode_t *node)
+void dcache_lru_push(inode_t *node)
 {
-    vec_push(&inodelist, (uint32_t)node);
+    node->_lru_prev = NULL;
+    node->_lru_next = dcache_head;
+    if (dcache_head)
+    {
+        dcache_head->_lru_prev = node;
+    }
+    else
+    {
+        dcache_tail = node;
+    }
+    dcache_head = node;
 }
 
-void inodelist_remove(inode_t *node)
+// drops the least recently used unreferenced nodes until the cache fits its budget again,
+// along with the references they hold on their parents
+void dcache_shrink()
 {
-    for (uint32_t i = 0; i < inodelist.size; i++)
+    while (dcache_stats.resident > DCACHE_BUDGET && dcache_tail)
     {
-        if ((inode_t *)inodelist.buffer[i] == node)
+        inode_t *node = dcache_tail;
+        inode_t *parent = node->_parent;
+        dcache_lru_remove(node);
+        dcache_remove(node);
+        pathbuf_free(&node->_pathbuf);
+        slab_free(&inode_cache, node);
+        dcache_stats.evictions++;
+        if (--parent->_refs == 0)
         {
-            vec_erase(&inodelist, i, 1);
+            dcache_lru_push(parent);
         }
     }
 }
 
-void *childtable_find(childtable_t *table, const char *name)
+// fnv-1a
+uint32_t dirindex_hash(const char *name)
 {
-    char *ptr = table->ptr;
-    while (1)
+    uint32_t hash = 2166136261;
+    for (; *name; name++)
     {
-        if ((char *)table->ptr + table->size <= ptr)
+        hash = (hash ^ (uint8_t)*name) * 16777619;
+    }
+    return hash;
+}
+
+// puts the pair in the first empty or deleted slot of its probe sequence, unless the sequence
+// already holds it: several names with the same hash in one sector share a slot
+void dirindex_place(inode_t *node, uint32_t hash, uint32_t sector)
+{
+    uint32_t slots = node->dir_index_sectors * DIRINDEX_PER_SECTOR;
+    uint32_t free = slots;
+    for (uint32_t slot = hash & (slots - 1);; slot = (slot + 1) & (slots - 1))
+    {
+        buf_t *ibuf = bcache_get(node->dir_index + slot / DIRINDEX_PER_SECTOR);
+        dirindex_t *entry = &((dirindex_t *)ibuf->data)[slot % DIRINDEX_PER_SECTOR];
+        if (entry->hash == hash && entry->sector == sector + 1)
         {
-            break;
+            bcache_release(ibuf);
+            return;
+        }
+        if (entry->sector == DIRINDEX_DELETED && free == slots)
+        {
+            free = slot;
         }
-        if (strcmp(ptr, name) == 0)
+        if (entry->sector == DIRINDEX_EMPTY)
         {
+            if (free == slots)
+            {
+                node->dir_index_used++;
+                free = slot;
+            }
+            bcache_release(ibuf);
             break;
         }
-        ptr += strlen(ptr) + 1 + sizeof(lba28_t);
+        bcache_release(ibuf);
     }
-    if (ptr >= (char *)table->ptr + table->size)
+    buf_t *ibuf = bcache_get(node->dir_index + free / DIRINDEX_PER_SECTOR);
+    dirindex_t *entry = &((dirindex_t *)ibuf->data)[free % DIRINDEX_PER_SECTOR];
+    entry->hash = hash;
+    entry->sector = sector + 1;
+    journal_dirty(ibuf);
+    bcache_release(ibuf);
+}
+
+// a fresh index sized for twice the children, filled from the records. it is built in memory and
+// written home to a new run, only the inode switching to it goes through the journal
+void dirindex_build(inode_t *node)
+{
+    uint32_t sectors = 1;
+    while (sectors * DIRINDEX_PER_SECTOR < node->child_count * 2 + 2)
     {
-        return NULL;
+        sectors *= 2;
     }
-    else
+    uint32_t slots = sectors * DIRINDEX_PER_SECTOR;
+    dirindex_t *table = kmalloc(sectors * SECTOR_SIZE);
+    memset(table, 0, sectors * SECTOR_SIZE);
+    uint32_t used = 0;
+    for (uint32_t sector = 0; sector < node->size / SECTOR_SIZE; sector++)
+    {
+        buf_t *buf = childtable_sector(node, sector);
+        for (uint32_t offset = 0; offset < SECTOR_SIZE;)
+        {
+            dirent_t *rec = (dirent_t *)(buf->data + offset);
+            if (rec->index)
+            {
+                uint32_t hash = dirindex_hash(rec->name);
+                uint32_t slot = hash & (slots - 1);
+                while (table[slot].sector != DIRINDEX_EMPTY &&
+                       (table[slot].hash != hash || table[slot].sector != sector + 1))
+                {
+                    slot = (slot + 1) & (slots - 1);
+                }
+                if (table[slot].sector == DIRINDEX_EMPTY)
+                {
+                    table[slot].hash = hash;
+                    table[slot].sector = sector + 1;
+                    used++;
+                }
+            }
+            offset += rec->rec_len;
+        }
+        bcache_release(buf);
+    }
+    if (node->dir_index)
     {
-        return ptr;
+        bfree(node->dir_index, node->dir_index_sectors);
     }
+    node->dir_index = balloc(sectors);
+    node->dir_index_sectors = sectors;
+    node->dir_index_used = used;
+    // the run is unused until the inode commits, the commit's flush orders it before the header
+    bcache_write(node->dir_index, sectors, table);
+    bcache_flush_range(node->dir_index, sectors);
+    kfree(table);
+    inode_update(node);
 }
-void childtable_add(childtable_t *table, const char *name, lba28_t index)
+
+void dirindex_insert(inode_t *node, uint32_t hash, uint32_t sector)
+{
+    // deleted slots count as used, so probe sequences always end at an empty one
+    if ((node->dir_index_used + 1) * 4 > node->dir_index_sectors * DIRINDEX_PER_SECTOR * 3)
+    {
+        dirindex_build(node);
+        return;
+    }
+    dirindex_place(node, hash, sector);
+}
+
+void dirindex_remove(inode_t *node, uint32_t hash, uint32_t sector)
+{
+    uint32_t slots = node->dir_index_sectors * DIRINDEX_PER_SECTOR;
+    for (uint32_t i = 0, slot = hash & (slots - 1); i < slots; i++, slot = (slot + 1) & (slots - 1))
+    {
+        buf_t *ibuf = bcache_get(node->dir_index + slot / DIRINDEX_PER_SECTOR);
+        dirindex_t *entry = &((dirindex_t *)ibuf->data)[slot % DIRINDEX_PER_SECTOR];
+        if (entry->sector == DIRINDEX_EMPTY)
+        {
+            bcache_release(ibuf);
+            return;
+        }
+        if (entry->hash == hash && entry->sector == sector + 1)
+        {
+            // other names with this hash in the same sector share the entry
+            buf_t *buf;
+            dirent_t *rec = NULL;
+            buf = childtable_sector(node, sector);
+            for (uint32_t offset = 0; offset < SECTOR_SIZE && !rec;)
+            {
+                dirent_t *other = (dirent_t *)(buf->data + offset);
+                if (other->index && dirindex_hash(other->name) == hash)
+                {
+                    rec = other;
+                }
+                offset += other->rec_len;
+            }
+            bcache_release(buf);
+            if (!rec)
+            {
+                entry->sector = DIRINDEX_DELETED;
+                journal_dirty(ibuf);
+            }
+            bcache_release(ibuf);
+            return;
+        }
+        bcache_release(ibuf);
+    }
+}
+
+// the directory's sector, checked so a corrupted record can't take a scan outside of it
+buf_t *childtable_sector(inode_t *node, uint32_t sector)
+{
+    uint32_t run;
+    buf_t *buf = bcache_get(inode_bmap(node, sector, &run));
+    uint32_t offset = 0;
+    while (offset < SECTOR_SIZE)
+    {
+        dirent_t *rec = (dirent_t *)(buf->data + offset);
+        if (rec->rec_len < DIRENT_HEADER_SIZE || offset + rec->rec_len > SECTOR_SIZE ||
+            (rec->index && dirent_size(rec->name_len) > rec->rec_len))
+        {
+            kpanic("directory %u is corrupted at sector %u", node->index, sector);
+        }
+        offset += rec->rec_len;
+    }
+    return buf;
+}
+
+// looks for the name in one sector of the directory, the sector stays held in *bufp if found
+dirent_t *childtable_find_in(inode_t *node, uint32_t sector, const char *name, buf_t **bufp, dirent_t **prevp)
 {
     uint32_t name_len = strlen(name);
-    uint32_t new_size = table->size + sizeof(lba28_t) + name_len + 1;
-    if (new_size > table->sectors * SECTOR_SIZE)
+    buf_t *buf = childtable_sector(node, sector);
+    dirent_t *prev = NULL;
+    for (uint32_t offset = 0; offset < SECTOR_SIZE;)
     {
-        table->sectors++;
-        void *buffer = kmalloc(table->sectors * SECTOR_SIZE);
-        memcpy(buffer, table->ptr, table->size);
-        kfree(table->ptr);
-        table->ptr = buffer;
+        dirent_t *rec = (dirent_t *)(buf->data + offset);
+        if (rec->index && rec->name_len == name_len && strcmp(rec->name, name) == 0)
+        {
+            *bufp = buf;
+            if (prevp)
+            {
+                *prevp = prev;
+            }
+            return rec;
+        }
+        prev = rec;
+        offset += rec->rec_len;
     }
-    char *end = table->ptr + table->size;
-    strcpy(end, name);
-    end[name_len] = 0;
-    *(uint32_t *)(end + name_len + 1) = index;
-    table->size = new_size;
+    bcache_release(buf);
+    return NULL;
 }
-void childtable_remove(childtable_t *table, const char *name)
+
+// finds the record of the name, its sector is held in *bufp and its number stored in *sectorp
+dirent_t *childtable_find(inode_t *node, const char *name, buf_t **bufp, dirent_t **prevp, uint32_t *sectorp)
 {
-    char *rec = childtable_find(table, name);
-    if (rec == NULL)
+    if (node->dir_index)
     {
-        return;
+        // only the sectors the index points at for this hash are searched
+        uint32_t hash = dirindex_hash(name);
+        uint32_t slots = node->dir_index_sectors * DIRINDEX_PER_SECTOR;
+        buf_t *ibuf = NULL;
+        for (uint32_t i = 0, slot = hash & (slots - 1); i < slots; i++, slot = (slot + 1) & (slots - 1))
+        {
+            if (!ibuf || slot % DIRINDEX_PER_SECTOR == 0)
+            {
+                if (ibuf)
+                {
+                    bcache_release(ibuf);
+                }
+                ibuf = bcache_get(node->dir_index + slot / DIRINDEX_PER_SECTOR);
+            }
+            dirindex_t entry = ((dirindex_t *)ibuf->data)[slot % DIRINDEX_PER_SECTOR];
+            if (entry.sector == DIRINDEX_EMPTY)
+            {
+                break;
+            }
+            if (entry.sector == DIRINDEX_DELETED || entry.hash != hash)
+            {
+                continue;
+            }
+            dirent_t *rec = childtable_find_in(node, entry.sector - 1, name, bufp, prevp);
+            if (rec)
+            {
+                bcache_release(ibuf);
+                if (sectorp)
+                {
+                    *sectorp = entry.sector - 1;
+                }
+                return rec;
+            }
+        }
+        if (ibuf)
+        {
+            bcache_release(ibuf);
+        }
+        return NULL;
+    }
+    for (uint32_t sector = 0; sector < node->size / SECTOR_SIZE; sector++)
+    {
+        dirent_t *rec = childtable_find_in(node, sector, name, bufp, prevp);
+        if (rec)
+        {
+            if (sectorp)
+            {
+                *sectorp = sector;
+            }
+            return rec;
+        }
     }
+    return NULL;
+}
+void childtable_add(inode_t *node, const char *name, lba28_t index)
+{
     uint32_t name_len = strlen(name);
-    char *next_rec = rec + name_len + 1 + sizeof(lba28_t);
-    memcpy(rec, next_rec, (char *)table->ptr + table->size - next_rec);
-    uint32_t new_size = table->size - name_len - 1 - sizeof(lba28_t);
-    if (new_size <= (table->sectors - 1) * SECTOR_SIZE)
+    uint32_t needed = dirent_size(name_len);
+    uint32_t sectors = node->size / SECTOR_SIZE;
+    buf_t *buf = NULL;
+    dirent_t *rec = NULL;
+    uint32_t sector = 0;
+    // the first free slot, or the first record with enough room left behind its name,
+    // looking from where the last one was found
+    for (uint32_t i = 0; i < sectors && !rec; i++)
     {
-        table->sectors--;
+        sector = (node->_dir_hint + i) % sectors;
+        buf = childtable_sector(node, sector);
+        for (uint32_t offset = 0; offset < SECTOR_SIZE;)
+        {
+            dirent_t *slot = (dirent_t *)(buf->data + offset);
+            uint32_t used = slot->index ? dirent_size(slot->name_len) : 0;
+            if (slot->rec_len - used >= needed)
+            {
+                if (used)
+                {
+                    rec = (dirent_t *)((char *)slot + used);
+                    rec->rec_len = slot->rec_len - used;
+                    slot->rec_len = used;
+                }
+                else
+                {
+                    rec = slot;
+                }
+                break;
+            }
+            offset += slot->rec_len;
+        }
+        if (!rec)
+        {
+            bcache_release(buf);
+        }
+    }
+    if (!rec)
+    {
+        // a new sector holding a single record that spans all of it
+        sector = sectors;
+        if (sector == node->alloc)
+        {
+            inode_realloc(node, node->alloc + 1);
+        }
+        uint32_t run;
+        buf = bcache_getblk(inode_bmap(node, sector, &run));
+        memset(buf->data, 0, SECTOR_SIZE);
+        rec = (dirent_t *)buf->data;
+        rec->rec_len = SECTOR_SIZE;
+        node->size += SECTOR_SIZE;
+    }
+    rec->index = index;
+    rec->name_len = name_len;
+    memcpy(rec->name, name, name_len + 1);
+    journal_dirty(buf);
+    bcache_release(buf);
+    node->_dir_hint = sector;
+
+    if (node->dir_index)
+    {
+        dirindex_insert(node, dirindex_hash(name), sector);
+    }
+    else if (node->size / SECTOR_SIZE >= DIRINDEX_MIN_SECTORS)
+    {
+        dirindex_build(node);
     }
-    table->size = new_size;
 }
-void childtable_edit_index(childtable_t *table, const char *name, lba28_t new)
+void childtable_remove(inode_t *node, const char *name)
 {
-    char *rec = childtable_find(table, name);
+    buf_t *buf;
+    dirent_t *prev;
+    uint32_t sector;
+    dirent_t *rec = childtable_find(node, name, &buf, &prev, &sector);
     if (rec == NULL)
     {
         return;
     }
-    lba28_t *index = (lba28_t *)(rec + strlen(name) + 1);
-    *index = new;
+    // the space goes to the record before it, the first record of a sector becomes a free slot
+    if (prev)
+    {
+        prev->rec_len += rec->rec_len;
+    }
+    else
+    {
+        rec->index = 0;
+    }
+    journal_dirty(buf);
+    bcache_release(buf);
+    node->_dir_hint = min(node->_dir_hint, sector);
+    if (node->dir_index)
+    {
+        dirindex_remove(node, dirindex_hash(name), sector);
+    }
 }
-void childtable_edit_name(childtable_t *table, const char *old, const char *new)
+void childtable_edit_name(inode_t *node, const char *old, const char *new)
 {
-    lba28_t index = childtable_get(table, old);
+    lba28_t index = childtable_get(node, old);
     if (index == 0)
     {
         return;
     }
-    childtable_remove(table, old);
-    childtable_add(table, new, index);
+    childtable_remove(node, old);
+    childtable_add(node, new, index);
 }
-lba28_t childtable_get(childtable_t *table, const char *name)
+lba28_t childtable_get(inode_t *node, const char *name)
 {
-    char *rec = childtable_find(table, name);
+    buf_t *buf;
+    dirent_t *rec = childtable_find(node, name, &buf, NULL, NULL);
     if (rec == NULL)
     {
         return 0;
     }
-    lba28_t *index = (lba28_t *)(rec + strlen(name) + 1);
-    return *index;
+    lba28_t index = rec->index;
+    bcache_release(buf);
+    return index;
 }
 
 void fs_close(inode_t *node)
@@ -434,58 +1326,67 @@ void fs_close(inode_t *node)
     if (node)
     {
         parent = node->_parent;
+        fs_node_flush(node);
     }
     fs_node_close(node);
     fs_node_close(parent);
 }
 
+// nodes stay cached once looked up, nonexistent names as invalid nodes, so walking a known path
+// costs a hash probe per component
 inode_t *fs_node_child(inode_t *node, const char *name)
 {
     if (!node)
     {
         return NULL;
     }
-    pathbuf_t pathbuf = pathbuf_child(&node->_pathbuf, name, 1);
-    inode_t *child = inodelist_get(&pathbuf);
-    if (child)
+    uint32_t hash = dirindex_hash(name);
+    inode_t *child = dcache_lookup(node, name, hash);
+    if (!child)
     {
-        pathbuf_free(&pathbuf);
-        return child;
+        krwlock_read(&node->_lock);
+        child = dcache_lookup(node, name, hash);
+        if (!child)
+        {
+            child = inode_new(pathbuf_child(&node->_pathbuf, name, 1));
+            child->_parent = node;
+            child->_hash = hash;
+            node->_refs++;
+            dcache_insert(child);
+            dcache_stats.misses++;
+            dcache_shrink();
+            krwlock_write(&child->_lock);
+            inode_child(node, name, child);
+            krwlock_release(&child->_lock);
+            krwlock_release(&node->_lock);
+            return child;
+        }
+        krwlock_release(&node->_lock);
     }
-    krwlock_read(&node->_lock);
-    child = inodelist_get(&pathbuf);
-    if (child)
+    dcache_stats.hits++;
+    if (child->_refs++ == 0)
     {
-        pathbuf_free(&pathbuf);
-        return child;
+        dcache_lru_remove(child);
     }
-    child = inode_new(pathbuf);
-    krwlock_write(&child->_lock);
-    inode_child(node, name, child);
-    krwlock_release(&node->_lock);
-    krwlock_release(&child->_lock);
-
     return child;
 }
 
 inode_t *fs_node_root()
 {
-    inode_t *node = (inode_t *)inodelist.buffer[0];
-    node->_refs++;
-    return node;
+    fs_root->_refs++;
+    return fs_root;
 }
 
 void fs_node_close(inode_t *node)
 {
     if (node && --node->_refs == 0)
     {
-        inodelist_remove(node);
-        pathbuf_free(&node->_pathbuf);
-        kfree(node);
+        dcache_lru_push(node);
+        dcache_shrink();
     }
 }
 
-int8_t fs_node_open(pathbuf_t *pathbuf, inode_t **node, inode_t **parent, inode_t **gparent)
+int8_t fs_node_open(pathbuf_t *pathbuf, inode_t **node, inode_t **parent)
 {
     inode_t *ptr = fs_node_root();
     vec_t loaded = vec_new();
@@ -522,14 +1423,6 @@ int8_t fs_node_open(pathbuf_t *pathbuf, inode_t **node, inode_t **parent, inode_
         {
             *parent = NULL;
         }
-        if (loaded.size)
-        {
-            *gparent = (inode_t *)vec_pop(&loaded);
-        }
-        else
-        {
-            *gparent = NULL;
-        }
     }
     for (uint32_t i = 0; i < loaded.size; i++)
     {
@@ -563,23 +1456,49 @@ void fs_node_unlock(inode_t *node)
     }
 }
 
+// writes back the appends a node gathered
+void fs_node_flush(inode_t *node)
+{
+    if (node->_wbuf)
+    {
+        fs_node_wrlock(node);
+        journal_begin();
+        inode_wbuf_flush(node);
+        fs_node_unlock(node);
+        journal_end();
+    }
+}
+
+// the parent is locked only when the open may add or remove its entry, and a plain open
+// only reads the node
 inode_t *fs_open(pathbuf_t *pathbuf, uint8_t create, uint8_t truncate, uint8_t dir, uint8_t unlink, int8_t *result)
 {
     inode_t *node;
     inode_t *parent;
-    inode_t *gparent;
-    int8_t rsl = fs_node_open(pathbuf, &node, &parent, &gparent);
+    int8_t rsl = fs_node_open(pathbuf, &node, &parent);
     if (rsl != 0)
     {
         *result = FS_ERR_INVALID_PATH;
         return NULL;
     }
-    fs_node_wrlock(gparent);
-    fs_node_wrlock(parent);
-    fs_node_wrlock(node);
+    uint8_t metadata = create || unlink;
+    if (metadata)
+    {
+        fs_node_wrlock(parent);
+    }
+    if (metadata || truncate)
+    {
+        fs_node_wrlock(node);
+        journal_begin();
+    }
+    else
+    {
+        fs_node_rdlock(node);
+    }
 
     uint8_t is_valid = node->isvalid;
     uint8_t is_dir = node->type == inode_type_dir ? 1 : 0;
+    uint32_t size = node->size;
 
     *result = 0;
 
@@ -587,7 +1506,7 @@ inode_t *fs_open(pathbuf_t *pathbuf, uint8_t create, uint8_t truncate, uint8_t d
     {
         if (create)
         {
-            inode_create(dir, parent, pathbuf_name(pathbuf), node, gparent);
+            inode_create(dir, parent, pathbuf_name(pathbuf), node);
         }
         else
         {
@@ -611,44 +1530,55 @@ inode_t *fs_open(pathbuf_t *pathbuf, uint8_t create, uint8_t truncate, uint8_t d
                 inode_delete(node, parent);
             }
         }
-        if (truncate)
+        if (truncate && node->isvalid)
         {
             inode_truncate(node);
         }
     }
 
-    node->_parent = parent;
-
-    fs_node_unlock(gparent);
-    fs_node_unlock(parent);
+    if (metadata)
+    {
+        fs_node_unlock(parent);
+    }
     fs_node_unlock(node);
-    fs_node_close(gparent);
+    if (metadata || truncate)
+    {
+        journal_end();
+    }
+    if (is_valid && (unlink || truncate))
+    {
+        pcache_invalidate(node, 0, size);
+    }
     return node;
 }
 
 int32_t fs_write(inode_t *node, const char *str, int32_t from, int32_t len)
 {
-    inode_t *parent = node->_parent;
     int32_t ret;
-    fs_node_wrlock(parent);
     fs_node_wrlock(node);
+    journal_begin();
     if (node->isvalid)
     {
-        inode_write(node, from, str, len, parent);
+        inode_write(node, from, str, len);
         ret = len;
     }
     else
     {
         ret = FS_ERR_DELETED;
     }
-    fs_node_unlock(parent);
     fs_node_unlock(node);
+    journal_end();
+    if (ret > 0)
+    {
+        pcache_update(node, from, str, len);
+    }
     return ret;
 }
 
 int32_t fs_read(inode_t *node, char *str, int32_t from, int32_t len)
 {
     int32_t ret;
+    fs_node_flush(node);
     fs_node_rdlock(node);
     if (node->isvalid)
     {
@@ -662,6 +1592,44 @@ int32_t fs_read(inode_t *node, char *str, int32_t from, int32_t len)
     return ret;
 }
 
+// called after a read of [from, from + count), prefetches what a sequential reader asks for next.
+// the window doubles every time the reader catches up with half of it
+void fs_readahead(inode_t *node, readahead_t *ra, uint32_t from, uint32_t count)
+{
+    if (from != ra->next)
+    {
+        // a seek, the reads aren't sequential until the next one carries on from here
+        ra->next = from + count;
+        ra->window = 0;
+        return;
+    }
+    ra->next = from + count;
+    fs_node_rdlock(node);
+    uint32_t sector = (from + count) / SECTOR_SIZE;
+    uint32_t sectors = min((node->size + SECTOR_SIZE - 1) / SECTOR_SIZE, node->alloc);
+    if (ra->window == 0)
+    {
+        ra->window = READAHEAD_MIN;
+        ra->end = sector;
+    }
+    if (node->isvalid && ra->end < sector + ra->window / 2)
+    {
+        uint32_t start = max(ra->end, sector);
+        uint32_t end = min(sector + ra->window, sectors);
+        ra->window = min(ra->window * 2, READAHEAD_MAX);
+        while (start < end)
+        {
+            uint32_t run;
+            lba28_t lba = inode_bmap(node, start, &run);
+            run = min(run, end - start);
+            bcache_prefetch(lba, run);
+            start += run;
+        }
+        ra->end = max(ra->end, end);
+    }
+    fs_node_unlock(node);
+}
+
 int32_t fs_readdir(inode_t *node, char *buffer, int32_t from)
 {
     int32_t ret;
@@ -678,25 +1646,81 @@ int32_t fs_readdir(inode_t *node, char *buffer, int32_t from)
     return ret;
 }
 
-void fs_init()
+int32_t fs_fsync(inode_t *node)
+{
+    int32_t ret = 0;
+    fs_node_flush(node);
+    fs_node_rdlock(node);
+    if (node->isvalid)
+    {
+        // the data goes first, the metadata committed next must not point at stale sectors
+        for (uint32_t i = 0; i < node->extent_count; i++)
+        {
+            bcache_flush_range(node->extents[i].start, node->extents[i].count);
+        }
+        ata_flush();
+    }
+    else
+    {
+        ret = FS_ERR_DELETED;
+    }
+    fs_node_unlock(node);
+    if (ret == 0)
+    {
+        journal_commit();
+    }
+    return ret;
+}
+
+void fs_sync()
+{
+    while (wbuf_head)
+    {
+        // held, so the node can't be evicted while waiting for its lock
+        inode_t *node = wbuf_head;
+        node->_refs++;
+        fs_node_flush(node);
+        fs_node_close(node);
+    }
+    journal_begin();
+    balloc_persist();
+    journal_end();
+    journal_sync();
+    bcache_sync();
+}
+
+// commits the journal and writes back everything dirty once per interval, for a task of its own
+void fs_flusher()
+{
+    // kernel tasks run with interrupts disabled, just like syscalls do
+    asm_cli();
+    while (1)
+    {
+        fs_sync();
+        bcache_idle();
+    }
+}
+
+void fs_init(uint8_t mount)
 {
     // the order of these calls should'nt be randomly changed
     krwlock_init(&balloc_lock);
     ata_init();
-    binit();
+    bcache_init(BCACHE_DEFAULT_CAPACITY, mount == FS_MOUNT_WRITETHROUGH ? BCACHE_WRITETHROUGH : BCACHE_WRITEBACK);
+    binit(mount == FS_MOUNT_WRITETHROUGH);
 
+    journal_begin();
     char *root_index_buffer = kmalloc(SECTOR_SIZE);
-    ata_read(ROOT_INDEX_SECTOR, root_index_buffer);
+    bcache_read(ROOT_INDEX_SECTOR, 1, root_index_buffer);
     uint32_t root_index = *(uint32_t *)root_index_buffer;
     if (!root_index)
     {
-        root_index = FS_START_SECTOR;
+        root_index = balloc(1);
         *(uint32_t *)root_index_buffer = root_index;
-        ata_write(ROOT_INDEX_SECTOR, root_index_buffer);
+        journal_write(ROOT_INDEX_SECTOR, root_index_buffer);
     }
     kfree(root_index_buffer);
 
-    inodelist = vec_new();
     pathbuf_t root_path = pathbuf_root();
     inode_t *node_buffer = inode_new(root_path);
     inode_fetch(root_index, node_buffer);
@@ -705,10 +1729,17 @@ void fs_init()
     {
         node_buffer->isvalid = 1;
         node_buffer->child_count = 0;
-        node_buffer->index = balloc(1);
+        node_buffer->index = root_index;
         node_buffer->size = 0;
         node_buffer->alloc = 0;
+        node_buffer->extent_count = 0;
+        node_buffer->dir_index = 0;
+        node_buffer->dir_index_sectors = 0;
+        node_buffer->dir_index_used = 0;
         node_buffer->type = inode_type_dir;
         inode_update(node_buffer);
     }
+    journal_end();
+    fs_root = node_buffer; // keeps the reference from inode_new, the root is never evicted
+    dcache_stats.resident += dcache_footprint(fs_root);
 }
\ No newline at end of file
@@ -7,25 +7,50 @@
 #include <lock.h>
 #include <pathbuf.h>
 #include <ata.h>
+#include <bcache.h>
 
 #define CHOP_ADD 0
 #define CHOP_REM 1
-#define CHOP_RELOC 2
 #define CHOP_RENAME 3
 
+#define FS_MOUNT_WRITEBACK 0    // writes stay in the buffer cache until flushed or synced
+#define FS_MOUNT_WRITETHROUGH 1 // every write reaches the media before returning
+
 #define FS_ERR_DELETED -1
 #define FS_ERR_INVALID_PATH -2
 #define FS_ERR_NONEXISTING -3
 #define FS_ERR_DIR_HAS_CHILD -4
 
+#define BALLOC_MAGIC 0x70616d62
+
 typedef uint32_t lba28_t;
 
+typedef struct
+{
+    lba28_t cursor; // where the next allocation starts looking
+    uint32_t magic;
+    lba28_t bitmap_start;
+    uint32_t bitmap_sectors;
+    uint32_t sectors;
+    lba28_t journal_start; // 0 until the first mount sets the journal up
+    uint32_t journal_sectors;
+} balloc_header_t;
+
 typedef enum
 {
     inode_type_file,
     inode_type_dir
 } inode_type;
 
+typedef struct
+{
+    lba28_t start;
+    uint32_t count;
+} extent_t;
+
+#define INODE_EXTENTS 32
+#define INODE_DISK_SIZE ((uint32_t) & ((inode_t *)0)->_refs) // the part of inode_t stored in its header sector
+
 typedef struct inode_t inode_t;
 
 struct /*__attribute__((packed))*/ inode_t
@@ -36,19 +61,50 @@ struct /*__attribute__((packed))*/ inode_t
     uint32_t alloc; // data sectors count
     uint32_t child_count;
     inode_type type;
+    uint32_t extent_count;
+    extent_t extents[INODE_EXTENTS]; // data runs in file order
+    lba28_t dir_index; // the hash index of a large directory, 0 if there is none
+    uint32_t dir_index_sectors;
+    uint32_t dir_index_used; // slots that are taken or deleted
 
     uint32_t _refs;
     pathbuf_t _pathbuf;
     krwlock _lock;
-    inode_t *_parent;
+    inode_t *_parent; // held by the node for as long as it is in the dentry cache
+    uint32_t _dir_hint; // the directory sector the last record went into
+    uint32_t _hash;     // of the name, the dentry cache is keyed by parent and hash
+    inode_t *_hnext;
+    inode_t *_lru_prev; // only unreferenced nodes are on the lru
+    inode_t *_lru_next;
+    char *_wbuf;           // appends not written yet, from the start of sector _wbuf_sector up to size
+    uint32_t _wbuf_sector; // the file sector the buffer starts at, unallocated sectors are allocated on flush
+    inode_t *_wbuf_next;
 };
 
+// a directory record, records never cross a sector and a sector is always covered by its records
+typedef struct __attribute__((packed))
+{
+    lba28_t index;    // 0 for a free slot
+    uint16_t rec_len; // up to the next record, covers the free space behind the name
+    uint16_t name_len;
+    char name[]; // null terminated
+} dirent_t;
+
+// a slot of a directory's hash index, the index only points at sectors of the records,
+// so the records alone are still a complete directory
 typedef struct
 {
-    void *ptr;
-    uint32_t size;
-    uint32_t sectors;
-} childtable_t;
+    uint32_t hash;
+    uint32_t sector; // directory sector + 1
+} dirindex_t;
+
+#define DIRINDEX_EMPTY 0
+#define DIRINDEX_DELETED 0xffffffff
+#define DIRINDEX_PER_SECTOR (SECTOR_SIZE / sizeof(dirindex_t))
+#define DIRINDEX_MIN_SECTORS 4 // directories are indexed from this size on
+
+#define DIRENT_HEADER_SIZE 8
+#define dirent_size(name_len) ((DIRENT_HEADER_SIZE + (name_len) + 1 + 3) & ~3)
 
 typedef struct
 {
@@ -72,52 +128,88 @@ typedef struct
 
 } child_operation;
 
-void binit();
+// counters of the in-memory inodes, cached by parent and name
+typedef struct
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t resident; // bytes held by cached nodes, referenced or not
+} dcache_stats_t;
+
+extern dcache_stats_t dcache_stats;
+extern krwlock balloc_lock;
+
+void binit(uint8_t sync);
 lba28_t balloc(lba28_t sectors);
-void bfree(lba28_t address);
-lba28_t brealloc(lba28_t address, lba28_t size);
+lba28_t balloc_try(lba28_t sectors);
+void bfree(lba28_t address, lba28_t size);
+void balloc_commit();
+void balloc_checkpoint();
+uint8_t bextend(lba28_t address, lba28_t size, lba28_t new_size);
 void balloc_update();
+void balloc_persist();
 void balloc_fetch();
 
-void childtable_add(childtable_t *table, const char *name, lba28_t index);
-void childtable_remove(childtable_t *table, const char *name);
-void childtable_edit_index(childtable_t *table, const char *name, lba28_t new);
-void childtable_edit_name(childtable_t *table, const char *old, const char *new);
-lba28_t childtable_get(childtable_t *table, const char *name);
-void *childtable_find(childtable_t *table, const char *name);
+uint32_t dirindex_hash(const char *name);
+void dirindex_place(inode_t *node, uint32_t hash, uint32_t sector);
+void dirindex_build(inode_t *node);
+void dirindex_insert(inode_t *node, uint32_t hash, uint32_t sector);
+void dirindex_remove(inode_t *node, uint32_t hash, uint32_t sector);
+buf_t *childtable_sector(inode_t *node, uint32_t sector);
+dirent_t *childtable_find_in(inode_t *node, uint32_t sector, const char *name, buf_t **bufp, dirent_t **prevp);
+dirent_t *childtable_find(inode_t *node, const char *name, buf_t **bufp, dirent_t **prevp, uint32_t *sectorp);
+void childtable_add(inode_t *node, const char *name, lba28_t index);
+void childtable_remove(inode_t *node, const char *name);
+void childtable_edit_name(inode_t *node, const char *old, const char *new);
+lba28_t childtable_get(inode_t *node, const char *name);
 
 void inode_child(inode_t *node, const char *name, inode_t *buffer);
-void inode_child_set(inode_t *node, child_operation op, inode_t *parent);
+void inode_child_set(inode_t *node, child_operation op);
 void inode_fetch(lba28_t index, inode_t *node);
 inode_t *inode_parent(inode_t *parent);
 void inode_calculate_operation_bounds(inode_t *node, operation_bounds *operation);
-void inode_realloc(inode_t *node, uint32_t sectors, inode_t *parent);
+void inode_realloc(inode_t *node, uint32_t sectors);
+void inode_compact(inode_t *node, uint32_t sectors);
+lba28_t inode_bmap(inode_t *node, uint32_t sector, uint32_t *count);
+void inode_io(inode_t *node, uint32_t sector, uint32_t count, char *buffer, uint8_t write);
+void inode_copy(inode_t *node, uint32_t from, char *buffer, uint32_t count, uint32_t size, uint8_t write);
+void inode_free_extents(inode_t *node);
 inode_t *inode_new(pathbuf_t pathbuf);
 uint32_t inode_read(inode_t *node, uint32_t from, char *buffer, uint32_t count);
 uint32_t inode_readdir(inode_t *node, uint32_t from, char *buffer);
-void inode_write(inode_t *node, uint32_t from, const char *buffer, uint32_t count, inode_t *parent);
+void inode_write(inode_t *node, uint32_t from, const char *buffer, uint32_t count);
 void inode_truncate(inode_t *node);
 void inode_delete(inode_t *node, inode_t *parent);
-void inode_create(uint8_t dir, inode_t *parent, const char *name, inode_t *node, inode_t *gparent);
+void inode_create(uint8_t dir, inode_t *parent, const char *name, inode_t *node);
 void inode_update(inode_t *node);
+uint8_t inode_wbuf_append(inode_t *node, uint32_t from, const char *buffer, uint32_t count);
+void inode_wbuf_flush(inode_t *node);
+void inode_wbuf_drop(inode_t *node);
 
 void fs_node_rdlock(inode_t *node);
 void fs_node_wrlock(inode_t *node);
 void fs_node_unlock(inode_t *node);
 inode_t *fs_node_child(inode_t *node, const char *name);
 inode_t *fs_node_root();
-int8_t fs_node_open(pathbuf_t *pathbuf, inode_t **node, inode_t **parent, inode_t **gparent);
+int8_t fs_node_open(pathbuf_t *pathbuf, inode_t **node, inode_t **parent);
 void fs_node_close(inode_t *node);
+void fs_node_flush(inode_t *node);
 
-inode_t *inodelist_get(pathbuf_t *pathbuf);
-void inodelist_remove(inode_t *node);
-void inodelist_add(inode_t *node);
+inode_t *dcache_lookup(inode_t *parent, const char *name, uint32_t hash);
+void dcache_insert(inode_t *node);
+void dcache_remove(inode_t *node);
+void dcache_shrink();
 
 inode_t *fs_open(pathbuf_t *pathbuf, uint8_t create, uint8_t truncate, uint8_t dir, uint8_t unlink, int8_t *result);
 void fs_close(inode_t *node);
 int32_t fs_write(inode_t *node, const char *str, int32_t from, int32_t len);
 int32_t fs_read(inode_t *node, char *str, int32_t from, int32_t len);
 int32_t fs_readdir(inode_t *node, char *buffer, int32_t from);
-void fs_init();
+void fs_readahead(inode_t *node, readahead_t *ra, uint32_t from, uint32_t count);
+int32_t fs_fsync(inode_t *node);
+void fs_sync();
+void fs_flusher();
+void fs_init(uint8_t mount);
 
 #endif
\ No newline at end of file
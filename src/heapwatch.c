@@ -65,47 +65,30 @@ void heapwatch_free(heapwatch_t *watch, uint32_t ptr)
 
 void heap_check(heap_t *heap, const char* label)
 {
-    hheader_t *start = heap->start;
-    hheader_t *end = heap->start + heap->size;
-    hheader_t *prev = NULL;
-    hheader_t *cur = heap->start;
-    hheader_t *next = NULL;
-
-    while (1)
+    for (uint32_t order = 0; order < KHEAP_ORDERS; order++)
     {
-        if (cur->is_hole > 1 || cur->prev > cur)
+        if (!heap->free[order] != !(heap->free_orders & (1u << order)))
         {
             kpanic("corrupted heap (1) [%s]",label);
         }
-        prev = cur->prev;
-        if (prev >= start)
+        hheader_t *prev = NULL;
+        for (hheader_t *block = heap->free[order]; block; block = block->next)
         {
-            if ((uint32_t)prev + sizeof(hheader_t) + prev->size != (uint32_t)cur)
+            uint32_t offset = (uint32_t)block - (uint32_t)heap->start;
+            if (offset >= heap->size || offset % (1u << order) != 0)
             {
                 kpanic("corrupted heap (2) [%s]",label);
             }
-            if (prev->is_hole && cur->is_hole)
+            uint32_t unit = offset >> KHEAP_MIN_ORDER;
+            if (block->order != order || !(heap->free_starts[unit / 32] & (1u << (unit % 32))))
             {
                 kpanic("corrupted heap (3) [%s]",label);
             }
-        }
-        next = (hheader_t *)((uint32_t)cur + sizeof(hheader_t) + cur->size);
-        if (next >= end)
-        {
-            break;
-        }
-        else
-        {
-            if (next->prev != cur)
+            if (block->prev != prev)
             {
                 kpanic("corrupted heap (4) [%s]",label);
             }
-
-            if (cur->is_hole && next->is_hole)
-            {
-                kpanic("corrupted heap (5) [%s]",label);
-            }
+            prev = block;
         }
-        cur = next;
     }
 }
\ No newline at end of file
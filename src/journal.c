@@ -0,0 +1,331 @@
+#include <journal.h>
+#include <kutil.h>
+#include <kqueue.h>
+#include <task.h>
+#include <vec.h>
+
+uint32_t journal_start;
+uint32_t journal_sectors;
+uint32_t journal_head; // where the next transaction goes
+uint32_t journal_sequence;
+uint8_t journal_synchronous; // every operation commits as it ends
+uint8_t journal_active = 0;
+uint8_t journal_blocked = 0; // a commit is waiting for the handles or writing
+uint32_t journal_handles = 0;
+uint32_t journal_reserve;      // blocks each handle may dirty
+uint32_t journal_reserved = 0; // by the running handles
+vec_t journal_blocks; // of the running transaction, each one held and kept from being written back
+kqueue_t journal_waitq;
+journal_callback_t journal_committed;
+journal_callback_t journal_checkpointed;
+journal_stats_t journal_stats;
+
+void journal_wait()
+{
+    kqueue_push(&journal_waitq, (uint32_t)task_curtask());
+    task_sleep();
+}
+
+void journal_wakeup()
+{
+    while (journal_waitq.size)
+    {
+        task_awake((task_t *)kqueue_pop(&journal_waitq));
+    }
+}
+
+// fnv-1a over whole words
+uint32_t journal_checksum(const char *data, uint32_t sectors)
+{
+    uint32_t hash = 2166136261;
+    const uint32_t *words = (const uint32_t *)data;
+    for (uint32_t i = 0; i < sectors * SECTOR_SIZE / 4; i++)
+    {
+        hash = (hash ^ words[i]) * 16777619;
+    }
+    return hash;
+}
+
+void journal_write_super()
+{
+    char *buffer = kmalloc(SECTOR_SIZE);
+    memset(buffer, 0, SECTOR_SIZE);
+    journal_super_t *super = (journal_super_t *)buffer;
+    super->magic = JOURNAL_MAGIC;
+    super->sequence = journal_sequence;
+    ata_write(journal_start, buffer);
+    ata_flush();
+    kfree(buffer);
+}
+
+// reads the transaction at pos into a new buffer, NULL unless it is whole
+char *journal_read_transaction(uint32_t pos, uint32_t *count)
+{
+    journal_desc_t *desc = kmalloc(SECTOR_SIZE);
+    ata_read(pos, desc);
+    uint32_t n = desc->count;
+    uint8_t valid = desc->magic == JOURNAL_MAGIC && desc->sequence == journal_sequence && n && n <= JOURNAL_TX_MAX;
+    kfree(desc);
+    if (!valid)
+    {
+        return NULL;
+    }
+    uint32_t descs = (n + JOURNAL_DESC_LBAS - 1) / JOURNAL_DESC_LBAS;
+    uint32_t len = descs + n + 1;
+    if (pos + len > journal_start + journal_sectors)
+    {
+        return NULL;
+    }
+    char *buffer = kmalloc(len * SECTOR_SIZE);
+    ata_read_n(pos, len, buffer);
+    for (uint32_t i = 0; i < descs; i++)
+    {
+        desc = (journal_desc_t *)(buffer + i * SECTOR_SIZE);
+        valid = valid && desc->magic == JOURNAL_MAGIC && desc->sequence == journal_sequence && desc->count == n;
+    }
+    journal_commit_t *commit = (journal_commit_t *)(buffer + (descs + n) * SECTOR_SIZE);
+    valid = valid && commit->magic == JOURNAL_MAGIC && commit->sequence == journal_sequence && commit->count == n &&
+            commit->checksum == journal_checksum(buffer, descs + n);
+    if (!valid)
+    {
+        kfree(buffer);
+        return NULL;
+    }
+    *count = n;
+    return buffer;
+}
+
+// copies the blocks of every committed transaction to their place, before anything else reads them
+void journal_replay(uint32_t start, uint32_t sectors)
+{
+    journal_start = start;
+    journal_sectors = sectors;
+    journal_super_t *super = kmalloc(SECTOR_SIZE);
+    ata_read(start, super);
+    uint8_t formatted = super->magic == JOURNAL_MAGIC;
+    journal_sequence = super->sequence;
+    kfree(super);
+    if (!formatted)
+    {
+        return;
+    }
+    uint32_t pos = start + 1;
+    uint32_t n;
+    char *buffer;
+    while ((buffer = journal_read_transaction(pos, &n)))
+    {
+        uint32_t descs = (n + JOURNAL_DESC_LBAS - 1) / JOURNAL_DESC_LBAS;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            journal_desc_t *desc = (journal_desc_t *)(buffer + i / JOURNAL_DESC_LBAS * SECTOR_SIZE);
+            bcache_write(desc->lba[i % JOURNAL_DESC_LBAS], 1, buffer + (descs + i) * SECTOR_SIZE);
+        }
+        kfree(buffer);
+        pos += descs + n + 1;
+        journal_sequence++;
+        journal_stats.replayed++;
+    }
+    bcache_sync();
+}
+
+// the journal starts out empty, whatever it held is expected to be replayed already
+void journal_init(uint32_t start, uint32_t sectors, uint8_t sync, uint32_t reserve, journal_callback_t committed,
+                  journal_callback_t checkpointed)
+{
+    if (reserve > JOURNAL_TX_MAX)
+    {
+        kpanic("an operation may dirty %u blocks, a transaction holds %u", reserve, JOURNAL_TX_MAX);
+    }
+    journal_start = start;
+    journal_sectors = sectors;
+    journal_head = start + 1;
+    journal_synchronous = sync;
+    journal_reserve = reserve;
+    journal_committed = committed;
+    journal_checkpointed = checkpointed;
+    journal_blocks = vec_new();
+    journal_waitq = kqueue_new();
+    journal_write_super();
+    journal_active = 1;
+}
+
+// brings every committed block home so the journal can start over, past this point
+// no old transaction is replayed over whatever a sector is reused for
+void journal_checkpoint()
+{
+    bcache_sync();
+    journal_head = journal_start + 1;
+    journal_write_super();
+    journal_stats.checkpoints++;
+    if (journal_checkpointed)
+    {
+        journal_checkpointed();
+    }
+}
+
+void journal_write_transaction()
+{
+    uint32_t n = journal_blocks.size;
+    uint32_t descs = (n + JOURNAL_DESC_LBAS - 1) / JOURNAL_DESC_LBAS;
+    uint32_t len = descs + n + 1;
+    char *buffer = kmalloc(len * SECTOR_SIZE);
+    memset(buffer, 0, descs * SECTOR_SIZE);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        buf_t *buf = (buf_t *)journal_blocks.buffer[i];
+        journal_desc_t *desc = (journal_desc_t *)(buffer + i / JOURNAL_DESC_LBAS * SECTOR_SIZE);
+        desc->magic = JOURNAL_MAGIC;
+        desc->sequence = journal_sequence;
+        desc->count = n;
+        desc->lba[i % JOURNAL_DESC_LBAS] = buf->lba;
+        memcpy(buffer + (descs + i) * SECTOR_SIZE, buf->data, SECTOR_SIZE);
+    }
+    journal_commit_t *commit = (journal_commit_t *)(buffer + (descs + n) * SECTOR_SIZE);
+    memset(commit, 0, SECTOR_SIZE);
+    commit->magic = JOURNAL_MAGIC;
+    commit->sequence = journal_sequence;
+    commit->count = n;
+    commit->checksum = journal_checksum(buffer, descs + n);
+    // one flush covers the whole transaction, the checksum tells a torn one apart
+    if (!ata_write_n(journal_head, len, buffer) || !ata_flush())
+    {
+        // nothing may go home as if it were committed
+        kpanic("journal commit %u failed to reach the disk", journal_sequence);
+    }
+    kfree(buffer);
+    journal_head += len;
+    journal_sequence++;
+
+    // committed blocks may go home now like any other dirty block
+    for (uint32_t i = 0; i < n; i++)
+    {
+        buf_t *buf = (buf_t *)journal_blocks.buffer[i];
+        buf->flags &= ~BUF_JOURNAL;
+        bcache_release(buf);
+    }
+    journal_blocks.size = 0;
+    journal_stats.commits++;
+    journal_stats.blocks += n;
+    if (journal_committed)
+    {
+        journal_committed();
+    }
+    if (journal_head + JOURNAL_TX_MAX / JOURNAL_DESC_LBAS + JOURNAL_TX_MAX + 2 > journal_start + journal_sectors)
+    {
+        journal_checkpoint();
+    }
+}
+
+// metadata changes are made between a begin and an end, the locks an operation needs are taken
+// before its begin so that a commit never waits on a handle that waits on a lock. a handle reserves
+// room for the most blocks an operation dirties, if the running transaction can't hold that it is
+// committed once the handles in it have ended
+void journal_begin()
+{
+    while (journal_blocked || journal_blocks.size + journal_reserved + journal_reserve > JOURNAL_TX_MAX)
+    {
+        if (!journal_blocked && !journal_handles)
+        {
+            journal_commit();
+            continue;
+        }
+        journal_wait();
+    }
+    journal_handles++;
+    journal_reserved += journal_reserve;
+}
+
+void journal_end()
+{
+    journal_reserved -= journal_reserve;
+    journal_handles--;
+    // what the handle left of its reservation may let a waiting one in
+    journal_wakeup();
+    if (journal_handles)
+    {
+        return;
+    }
+    if (journal_active && !journal_blocked && (journal_synchronous || journal_blocks.size >= JOURNAL_TX_BLOCKS))
+    {
+        journal_commit();
+    }
+}
+
+// the block joins the running transaction, it isn't written back before the transaction commits
+void journal_dirty(buf_t *buf)
+{
+    if (!journal_active)
+    {
+        bcache_dirty(buf);
+        return;
+    }
+    buf->flags |= BUF_VALID | BUF_DIRTY;
+    if (buf->flags & BUF_JOURNAL)
+    {
+        return;
+    }
+    buf->flags |= BUF_JOURNAL;
+    buf->refs++;
+    vec_push(&journal_blocks, (uint32_t)buf);
+}
+
+void journal_write(uint32_t lba, const void *buffer)
+{
+    buf_t *buf = bcache_getblk(lba);
+    memcpy(buf->data, buffer, SECTOR_SIZE);
+    journal_dirty(buf);
+    bcache_release(buf);
+}
+
+void journal_quiesce()
+{
+    while (journal_blocked)
+    {
+        journal_wait();
+    }
+    journal_blocked = 1;
+    while (journal_handles)
+    {
+        journal_wait();
+    }
+}
+
+void journal_resume()
+{
+    journal_blocked = 0;
+    journal_wakeup();
+}
+
+// groups every change made since the last commit into one transaction and waits until it is durable
+void journal_commit()
+{
+    if (!journal_active)
+    {
+        return;
+    }
+    journal_quiesce();
+    if (journal_blocks.size)
+    {
+        journal_write_transaction();
+    }
+    journal_resume();
+}
+
+// commits and then empties the journal
+void journal_sync()
+{
+    if (!journal_active)
+    {
+        return;
+    }
+    journal_quiesce();
+    if (journal_blocks.size)
+    {
+        journal_write_transaction();
+    }
+    if (journal_head != journal_start + 1)
+    {
+        journal_checkpoint();
+    }
+    journal_resume();
+}
@@ -0,0 +1,60 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <bcache.h>
+
+#define JOURNAL_SECTORS 2048
+#define JOURNAL_MAGIC 0x6c6e726a
+#define JOURNAL_TX_BLOCKS 256 // a transaction is committed once its last handle ends past this many blocks
+#define JOURNAL_TX_MAX 512    // what a single transaction may grow to, the journal always keeps room for it
+#define JOURNAL_DESC_LBAS ((SECTOR_SIZE - 12) / 4)
+
+// a transaction on disk is its descriptor sectors, the blocks they list and a commit sector,
+// it is replayed only if the commit sector checks out
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t sequence; // of the first transaction to replay
+} journal_super_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t count; // blocks in the whole transaction
+    uint32_t lba[JOURNAL_DESC_LBAS];
+} journal_desc_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t count;
+    uint32_t checksum; // of the descriptors and the blocks
+} journal_commit_t;
+
+typedef struct
+{
+    uint32_t commits;
+    uint32_t blocks;
+    uint32_t checkpoints;
+    uint32_t replayed;
+} journal_stats_t;
+
+typedef void (*journal_callback_t)();
+
+extern journal_stats_t journal_stats;
+
+void journal_replay(uint32_t start, uint32_t sectors);
+void journal_init(uint32_t start, uint32_t sectors, uint8_t sync, uint32_t reserve, journal_callback_t committed,
+                  journal_callback_t checkpointed);
+void journal_begin();
+void journal_end();
+void journal_dirty(buf_t *buf);
+void journal_write(uint32_t lba, const void *buffer);
+void journal_commit();
+void journal_sync();
+
+#endif
@@ -2,241 +2,236 @@
 #include <util.h>
 #include <kutil.h>
 #include <heapwatch.h>
+#include <asm.h>
 
+#define KHEAP_BENCH_BLOCKS 256
+#define KHEAP_BENCH_ROUNDS 16
+
+#ifdef KHEAP_DEBUG
 heapwatch_t watcher;
+#endif
 heap_t kernel_heap;
 
-int8_t compare_headers(uint32_t a, uint32_t b)
+uint32_t heap_order(uint32_t size)
+{
+    return size <= 1 ? 0 : 32 - __builtin_clz(size - 1);
+}
+
+uint32_t heap_unit(heap_t *heap, hheader_t *block)
 {
-    uint32_t as = ((hheader_t *)a)->size;
-    uint32_t bs = ((hheader_t *)b)->size;
-    if (as == bs)
+    return ((uint32_t)block - (uint32_t)heap->start) >> KHEAP_MIN_ORDER;
+}
+
+uint8_t heap_is_free(heap_t *heap, hheader_t *block)
+{
+    uint32_t unit = heap_unit(heap, block);
+    return (heap->free_starts[unit / 32] >> (unit % 32)) & 1;
+}
+
+void heap_push(heap_t *heap, hheader_t *block, uint32_t order)
+{
+    uint32_t unit = heap_unit(heap, block);
+    heap->free_starts[unit / 32] |= 1u << (unit % 32);
+    block->order = order;
+    block->prev = NULL;
+    block->next = heap->free[order];
+    if (block->next)
     {
-        return 0;
+        block->next->prev = block;
     }
-    else if (as > bs)
+    heap->free[order] = block;
+    heap->free_orders |= 1u << order;
+}
+
+void heap_remove(heap_t *heap, hheader_t *block, uint32_t order)
+{
+    uint32_t unit = heap_unit(heap, block);
+    heap->free_starts[unit / 32] &= ~(1u << (unit % 32));
+    if (block->prev)
     {
-        return 1;
+        block->prev->next = block->next;
     }
     else
     {
-        return -1;
+        heap->free[order] = block->next;
+    }
+    if (block->next)
+    {
+        block->next->prev = block->prev;
+    }
+    if (!heap->free[order])
+    {
+        heap->free_orders &= ~(1u << order);
     }
 }
 
 void heap_init(heap_t *heap, void *start, uint32_t size, uint32_t index_size, uint8_t readonly, uint8_t supervisor)
 {
+#ifdef KHEAP_DEBUG
     heapwatch_init(&watcher);
+#endif
     heap->size = size;
     heap->readonly = readonly;
     heap->supervisor = supervisor;
-
-    ordlist_place(&heap->index, (void *)start, index_size, ORDER_ASCENDING, compare_headers);
+    memset(start, 0, index_size);
+    heap->free_starts = start;
+    heap->page_orders = start + size / 128;
     start += index_size;
 
-    if ((uint32_t)start % 1000 != 0)
+    if ((uint32_t)start % 0x1000 != 0)
     {
         start = (void *)((uint32_t)start & 0xFFFFF000);
         start += 0x1000;
     }
 
     heap->start = start;
-    hheader_t *hole = (hheader_t *)start;
-    hole->is_hole = 1;
-    hole->size = size;
-    hole->prev = 0x0;
-    ordlist_insert(&heap->index, hole);
-}
-
-uint32_t alignment(uint32_t x)
-{
-    if (x % 0x1000 != 0)
-    {
-        x &= 0xFFFFF000;
-        x += 0x1000;
-    }
-    return x;
-}
-
-uint32_t alignment_o(uint32_t x, uint32_t offset)
-{
-    if (x % 0x1000 > offset)
+    memset(heap->free, 0, sizeof(heap->free));
+    heap->free_orders = 0;
+    // the largest blocks that fit, each one's buddy would lie past the end
+    uint32_t offset = 0;
+    while (size - offset >= (1u << KHEAP_MIN_ORDER))
     {
-        x &= 0xFFFFF000;
-        x += (0x1000 + offset);
+        uint32_t order = 31 - __builtin_clz(size - offset);
+        heap_push(heap, (hheader_t *)(start + offset), order);
+        offset += 1u << order;
     }
-    else
-    {
-        x &= 0xFFFFF000;
-        x += offset;
-    }
-    return x;
-}
-
-void heap_low_split(heap_t *heap, hheader_t *hole, int32_t size)
-{
-    hheader_t *newhole = (hheader_t *)((uint32_t)hole - size);
-    newhole->size = size - sizeof(hheader_t);
-    hole->size -= size;
-
-    newhole->prev = hole->prev;
-    hole->prev = newhole;
-
-    ordlist_insert(&heap->index, newhole);
-    newhole->is_hole = 1;
-}
-
-hheader_t *hheader_next(hheader_t *head)
-{
-    return (hheader_t *)((uint32_t)head + sizeof(hheader_t) + head->size);
 }
 
-uint8_t hheader_isvalid(hheader_t *head, heap_t *heap)
+// the smallest free block of at least the order, split down to it
+hheader_t *heap_take(heap_t *heap, uint32_t order)
 {
-    return (uint32_t)head < (uint32_t)heap->start + heap->size;
-}
-
-void heap_high_split(heap_t *heap, hheader_t *hole, uint32_t size)
-{
-    hheader_t *next = (hheader_t *)((uint32_t)hole + sizeof(hheader_t) + hole->size);
-    hheader_t *newhole = (hheader_t *)((uint32_t)next - size);
-    newhole->size = size - sizeof(hheader_t);
-    hole->size -= size;
-    newhole->prev = hole;
-    if (hheader_isvalid(next, heap))
+    uint32_t orders = heap->free_orders & ~((1u << order) - 1);
+    if (!orders)
     {
-        next->prev = newhole;
-    }
-    ordlist_insert(&heap->index, newhole);
-    newhole->is_hole = 1;
-}
-
-uint32_t heap_hole_index(heap_t *heap, hheader_t *head)
-{
-    for(uint32_t i=0;i<heap->index.size;i++)
-    {
-        if(heap->index.array[i] == head)
-        {
-            return i;
-        }
+        return NULL;
     }
-    return -1;
-}
-
-void heap_merge(heap_t *heap, hheader_t *hole)
-{
-    hheader_t *next = hheader_next(hole);
-    if (hheader_isvalid(next, heap) && next->is_hole)
+    uint32_t found = __builtin_ctz(orders);
+    hheader_t *block = heap->free[found];
+    heap_remove(heap, block, found);
+    while (found > order)
     {
-        hheader_t *next_next = hheader_next(next);
-        if (hheader_isvalid(next_next, heap))
-        {
-            next_next->prev = hole;
-        }
-        ordlist_remove(&heap->index, heap_hole_index(heap, next));
-        hole->size += (next->size + sizeof(hheader_t));
+        found--;
+        heap_push(heap, (hheader_t *)((uint32_t)block + (1u << found)), found);
     }
+    return block;
 }
 
+// blocks smaller than a page carry their order in front of the returned address, aligned
+// requests and anything larger get a headerless block of a page or more
 void *heap_alloc(heap_t *heap, uint32_t size, uint8_t align)
 {
-    heap_check(heap,"before alloc");
     if (size == 0)
     {
         return NULL;
     }
-    // find the best hole
-    uint32_t best_index = 0;
-    hheader_t *best_hole;
-    hheader_t *newaddr;
-    uint32_t extrasize;
-    uint32_t effsize;
-    while (best_index < ordlist_size(&heap->index))
+    uint8_t small = !align && size + sizeof(uint32_t) <= (1u << (KHEAP_PAGE_ORDER - 1));
+    uint32_t order;
+    if (small)
     {
-        best_hole = ordlist_get(&heap->index, best_index);
-        if (align)
-        {
-            newaddr = (hheader_t *)alignment_o((uint32_t)best_hole, 0x1000 - sizeof(hheader_t));
-            extrasize = (uint32_t)newaddr - (uint32_t)best_hole;
-            if (best_hole->size > extrasize)
-            {
-                effsize = best_hole->size - extrasize;
-                if (effsize >= size)
-                {
-                    break;
-                }
-            }
-        }
-        else
-        {
-            if (best_hole->size >= size)
-            {
-                break;
-            }
-        }
-        best_index++;
+        order = max(heap_order(size + sizeof(uint32_t)), KHEAP_MIN_ORDER);
     }
-    if (best_index == ordlist_size(&heap->index))
+    else
     {
-        return 0x0;
+        order = max(heap_order(size), KHEAP_PAGE_ORDER);
     }
-    best_hole->is_hole = 0;
-    ordlist_remove(&heap->index, best_index);
-    if (align)
+    hheader_t *block = order < KHEAP_ORDERS ? heap_take(heap, order) : NULL;
+    if (!block)
     {
-        *newaddr = *best_hole;
-        best_hole = newaddr;
-
-        if (extrasize > sizeof(hheader_t))
-        {
-            heap_low_split(heap, best_hole, extrasize);
-        }
-        else if (best_hole->prev != 0x0)
-        {
-            best_hole->prev->size += extrasize;
-        }
-        else
-        {
-            best_hole->prev = (hheader_t *)0x1;
-        }
+        return NULL;
     }
-    if (best_hole->size - size > sizeof(hheader_t))
+    void *ptr;
+    if (small)
     {
-        heap_high_split(heap, best_hole, best_hole->size - size);
+        block->order = order;
+        ptr = (void *)((uint32_t)block + sizeof(uint32_t));
     }
-    void *ptr = (void *)((uint32_t)best_hole + sizeof(hheader_t));
-
-    heapwatch_alloc(&watcher, (uint32_t)best_hole + sizeof(hheader_t), size);
-    heap_check(heap,"after alloc");
+    else
+    {
+        heap->page_orders[((uint32_t)block - (uint32_t)heap->start) >> KHEAP_PAGE_ORDER] = order;
+        ptr = block;
+    }
+#ifdef KHEAP_DEBUG
+    heapwatch_alloc(&watcher, (uint32_t)ptr, size);
+    heap_check(heap, "after alloc");
+#endif
     return ptr;
 }
 
+// merges the block with its buddy for as long as the buddy is free and whole
 void heap_free(heap_t *heap, void *ptr)
 {
-    heap_check(heap,"before free");
+#ifdef KHEAP_DEBUG
     heapwatch_free(&watcher, (uint32_t)ptr);
+#endif
     if (!ptr)
     {
         return;
     }
-    hheader_t *block = (hheader_t *)((uint32_t)ptr - sizeof(hheader_t));
-    block->is_hole = 1;
-    ordlist_insert(&heap->index, block);
-    heap_merge(heap, block);
-    if (block->prev && block->prev->is_hole)
+    uint32_t offset = (uint32_t)ptr - (uint32_t)heap->start;
+    hheader_t *block;
+    uint32_t order;
+    if (offset % 0x1000 == 0)
+    {
+        block = ptr;
+        order = heap->page_orders[offset >> KHEAP_PAGE_ORDER];
+        heap->page_orders[offset >> KHEAP_PAGE_ORDER] = 0;
+    }
+    else
     {
-        if ((uint32_t)block->prev == 0x1)
+        block = (hheader_t *)((uint32_t)ptr - sizeof(uint32_t));
+        order = block->order;
+    }
+    while (order + 1 < KHEAP_ORDERS)
+    {
+        uint32_t buddy_offset = ((uint32_t)block - (uint32_t)heap->start) ^ (1u << order);
+        hheader_t *buddy = (hheader_t *)((uint32_t)heap->start + buddy_offset);
+        if (buddy_offset + (1u << order) > heap->size || !heap_is_free(heap, buddy) || buddy->order != order)
+        {
+            break;
+        }
+        heap_remove(heap, buddy, order);
+        block = (hheader_t *)min((uint32_t)block, (uint32_t)buddy);
+        order++;
+    }
+    heap_push(heap, block, order);
+#ifdef KHEAP_DEBUG
+    heap_check(heap, "after free");
+#endif
+}
+
+// times every call of a mix of small, page sized and aligned allocations freed in an order
+// unlike the one they were made in, with interrupts off the cycles are the allocator's own
+void heap_bench(heap_t *heap, heap_bench_t *bench)
+{
+    void *blocks[KHEAP_BENCH_BLOCKS];
+    uint32_t seed = 1;
+    memset(bench, 0, sizeof(heap_bench_t));
+    for (uint32_t round = 0; round < KHEAP_BENCH_ROUNDS; round++)
+    {
+        for (uint32_t i = 0; i < KHEAP_BENCH_BLOCKS; i++)
         {
-            hheader_t *block_rep = heap->start;
-            *block_rep = *block;
-            block_rep->size += ((uint32_t)block - (uint32_t)heap->start);
-            block = block_rep;
+            seed = seed * 1103515245 + 12345;
+            uint32_t size = i % 16 == 0 ? 0x1000 : 8 + (seed >> 16) % 512;
+            uint32_t start = asm_rdtsc();
+            blocks[i] = heap_alloc(heap, size, i % 64 == 0);
+            uint32_t cycles = asm_rdtsc() - start;
+            bench->allocs++;
+            bench->alloc_cycles += cycles;
+            bench->alloc_max = max(bench->alloc_max, cycles);
         }
-        else
+        // every other block first, then the rest backwards
+        for (uint32_t pass = 0; pass < 2; pass++)
         {
-            block = block->prev;
-            heap_merge(heap, block);
+            for (uint32_t j = 0; j < KHEAP_BENCH_BLOCKS / 2; j++)
+            {
+                uint32_t i = pass ? KHEAP_BENCH_BLOCKS - 1 - 2 * j : 2 * j;
+                uint32_t start = asm_rdtsc();
+                heap_free(heap, blocks[i]);
+                uint32_t cycles = asm_rdtsc() - start;
+                bench->frees++;
+                bench->free_cycles += cycles;
+                bench->free_max = max(bench->free_max, cycles);
+            }
         }
     }
-    heap_check(heap,"after free");
 }
\ No newline at end of file
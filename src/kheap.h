@@ -1,32 +1,54 @@
 #ifndef KHEAP_H
 #define KHEAP_H
 
-#define KHEAP_INDEX_SIZE 0x20000
+#include <stdint.h>
 
-#include <ordlist.h>
+#define KHEAP_MIN_ORDER 4 // 16 bytes, room for the header of a free block
+#define KHEAP_PAGE_ORDER 12
+#define KHEAP_ORDERS 32
+
+// space before the heap for its bookkeeping, a bit per KHEAP_MIN_ORDER unit and a byte per page
+#define KHEAP_INDEX_SIZE(size) ((size) / 128 + (size) / 0x1000)
 
 typedef struct hheader_t hheader_t;
 
+// starts every free block and every allocated one smaller than a page. allocated blocks of a page
+// or more have no header so that they stay page aligned, their order is kept in the page map
 struct hheader_t
 {
-    uint8_t is_hole;
-    uint32_t size;
-    hheader_t *prev;
-} __attribute__((packed));
+    uint32_t order;
+    hheader_t *prev; // the free list of the order, only while the block is free
+    hheader_t *next;
+};
 
+// a binary buddy allocator, blocks are powers of two aligned to their size from the heap's start
 typedef struct
 {
-    ordlist_t index;
     void *start;
     uint32_t size;
     uint8_t readonly;
     uint8_t supervisor;
+    uint32_t *free_starts; // a bit per KHEAP_MIN_ORDER unit, set where a free block starts
+    uint8_t *page_orders;  // the order of the headerless block starting at each page
+    hheader_t *free[KHEAP_ORDERS];
+    uint32_t free_orders; // a bit per order whose free list isn't empty
 } heap_t;
 
+typedef struct
+{
+    uint32_t allocs;
+    uint32_t alloc_cycles;
+    uint32_t alloc_max;
+    uint32_t frees;
+    uint32_t free_cycles;
+    uint32_t free_max;
+} heap_bench_t;
+
 extern heap_t kernel_heap;
 
 void heap_init(heap_t *heap, void *start, uint32_t size, uint32_t index_size, uint8_t readonly, uint8_t supervisor);
 void *heap_alloc(heap_t *heap, uint32_t size, uint8_t align);
 void heap_free(heap_t *heap, void *ptr);
+void heap_bench(heap_t *heap, heap_bench_t *bench);
 
 #endif
\ No newline at end of file
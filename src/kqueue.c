@@ -1,24 +1,22 @@
 #include <kqueue.h>
 #include <util.h>
+#include <slab.h>
 
-kqueue_t kqueue_new()
-{
-    return kqueue_new_h(&kernel_heap);
-}
+// every wait and every switch of task goes through a queue element
+slab_cache_t kqueue_cache = SLAB_CACHE(sizeof(kqueue_ele));
 
-kqueue_t kqueue_new_h(heap_t *heap)
+kqueue_t kqueue_new()
 {
     kqueue_t queue;
     queue.size = 0;
     queue.head = NULL;
     queue.tail = NULL;
-    queue.heap = heap;
     return queue;
 }
 
 void kqueue_push(kqueue_t *queue, uint32_t value)
 {
-    kqueue_ele *ele = heap_alloc(queue->heap, sizeof(kqueue_ele), 0);
+    kqueue_ele *ele = slab_alloc(&kqueue_cache);
     ele->value = value;
     ele->next = NULL;
     if (queue->size)
@@ -36,7 +34,7 @@ void kqueue_push(kqueue_t *queue, uint32_t value)
 uint32_t kqueue_pop(kqueue_t *queue)
 {
     kqueue_ele ele = *queue->head;
-    heap_free(queue->heap, queue->head);
+    slab_free(&kqueue_cache, queue->head);
     queue->head = ele.next;
     if (!ele.next)
     {
@@ -56,8 +54,8 @@ void kqueue_clear(kqueue_t *queue)
     kqueue_ele *ele = queue->head;
     while (ele)
     {
-        kqueue_ele *next = ele;
-        heap_free(queue->heap, ele);
+        kqueue_ele *next = ele->next;
+        slab_free(&kqueue_cache, ele);
         ele = next;
     }
     queue->head = NULL;
@@ -5,6 +5,8 @@
     extern kinit
     extern kmain
     extern user_stack_ptr
+    global multiboot_magic
+    global multiboot_info
 
     global user_write
     global inldr_start
@@ -44,6 +46,8 @@ align 4                         ; the code must be 4 byte aligned
 
 section .text                     ; Kernel entry point (initial EIP).
 loader:                         ; the loader label (defined as entry point in linker script)
+    mov [multiboot_magic], eax      ; the boot loader's signature and its information structure
+    mov [multiboot_info], ebx
     mov esp, initial_stack + INITIAL_STACK_SIZE
     mov ebp, esp
     call kinit
@@ -79,6 +83,8 @@ user_write:
 
 section .bss
     initial_stack resb INITIAL_STACK_SIZE
+    multiboot_magic resd 1
+    multiboot_info resd 1
 section .data
 symtable_count:
     dd 0x00000000
@@ -31,6 +31,7 @@ void krwlock_read(krwlock *lock)
     if (lock->operation == KRWLOCK_WRITE ||
         (lock->operation == KRWLOCK_READ && lock->opq.size && kqueue_peek(&lock->opq) == KRWLOCK_WRITE))
     {
+        lock->contended++;
         kqueue_push(&lock->procq, (uint32_t)task_curtask());
         kqueue_push(&lock->opq, KRWLOCK_READ);
         task_sleep();
@@ -47,18 +48,30 @@ void krwlock_write(krwlock *lock)
 {
     if (lock->operation != KRWLOCK_NONE)
     {
+        lock->contended++;
         kqueue_push(&lock->procq, (uint32_t)task_curtask());
         kqueue_push(&lock->opq, KRWLOCK_WRITE);
         task_sleep();
     }
     lock->operation = KRWLOCK_WRITE;
 }
+// takes the lock for writing only if that doesn't mean waiting
+uint8_t krwlock_try_write(krwlock *lock)
+{
+    if (lock->operation != KRWLOCK_NONE || lock->procq.size)
+    {
+        return 0;
+    }
+    lock->operation = KRWLOCK_WRITE;
+    return 1;
+}
 void krwlock_init(krwlock *lock)
 {
     lock->procq = kqueue_new();
     lock->opq = kqueue_new();
     lock->operation = KRWLOCK_NONE;
     lock->readers = 0;
+    lock->contended = 0;
 }
 void krwlock_release(krwlock *lock)
 {
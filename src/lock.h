@@ -16,6 +16,7 @@ typedef struct
     kqueue_t opq;
     uint32_t readers;
     int8_t operation;
+    uint32_t contended; // times a task had to wait for the lock
 } krwlock;
 
 void ksemaphore_init(ksemaphore_t *sem, uint32_t initial);
@@ -24,6 +25,7 @@ void ksemaphore_signal(ksemaphore_t *sem);
 
 void krwlock_read(krwlock *lock);
 void krwlock_write(krwlock *lock);
+uint8_t krwlock_try_write(krwlock *lock);
 void krwlock_init(krwlock *lock);
 void krwlock_release(krwlock *lock);
 
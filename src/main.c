@@ -15,6 +15,21 @@
 #include <lock.h>
 #include <kb.h>
 #include <trace.h>
+#include <mmap.h>
+
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+#define MULTIBOOT_INFO_CMDLINE 0x4
+#define BOOT_CMDLINE_SIZE 256
+
+// the start of the structure a multiboot loader hands over, up to the command line
+typedef struct
+{
+    uint32_t flags;
+    uint32_t mem_lower;
+    uint32_t mem_upper;
+    uint32_t boot_device;
+    uint32_t cmdline;
+} multiboot_info_t;
 
 terminal_t glb_term;
 gdtrec glb_gdt_records[6];
@@ -26,6 +41,9 @@ int32_t user_write(uint32_t fd, void *buffer, uint32_t length);
 
 extern uint32_t inldr_end;
 extern uint32_t inldr_start;
+extern uint32_t multiboot_magic;
+extern uint32_t multiboot_info;
+char boot_cmdline[BOOT_CMDLINE_SIZE]; // copied before paging is enabled, wherever the boot loader put it
 
 void timer_init(uint32_t frequency)
 {
@@ -71,18 +89,61 @@ void common_int_handler(registers *regs)
     }
 }
 
+void boot_cmdline_init()
+{
+    boot_cmdline[0] = 0;
+    multiboot_info_t *info = (multiboot_info_t *)multiboot_info;
+    if (multiboot_magic != MULTIBOOT_BOOTLOADER_MAGIC || !(info->flags & MULTIBOOT_INFO_CMDLINE))
+    {
+        return;
+    }
+    const char *cmdline = (const char *)info->cmdline;
+    uint32_t len = min(strlen(cmdline), BOOT_CMDLINE_SIZE - 1);
+    memcpy(boot_cmdline, cmdline, len);
+    boot_cmdline[len] = 0;
+}
+
+// whether the word appears on the kernel's command line, e.g. "multiboot /boot/kernel writethrough"
+uint8_t boot_option(const char *name)
+{
+    uint32_t len = strlen(name);
+    for (const char *word = boot_cmdline; *word;)
+    {
+        uint32_t word_len = 0;
+        while (word[word_len] && word[word_len] != ' ')
+        {
+            word_len++;
+        }
+        uint32_t i = 0;
+        while (i < len && i < word_len && word[i] == name[i])
+        {
+            i++;
+        }
+        if (i == len && word_len == len)
+        {
+            return 1;
+        }
+        word += word_len;
+        while (*word == ' ')
+        {
+            word++;
+        }
+    }
+    return 0;
+}
+
 void kinit()
 {
     // the order of these calls should'nt be randomly changed
+    boot_cmdline_init();
     term_init(&glb_term);
     term_fg(&glb_term);
     load_gdt_recs(glb_gdt_records, &tss_entry);
     load_idt_recs(common_int_handler);
     uint32_t heap_effective_size = 0x1000000;
-    uint32_t heap_index_size = 0x4000;
-    uint32_t heap_total_size = heap_effective_size + heap_index_size;
-    heap_init(&kernel_heap, &end, heap_total_size, heap_index_size, 1, 1);
-    kernel_memory_end = (uint32_t)kernel_heap.start + heap_total_size;
+    uint32_t heap_index_size = KHEAP_INDEX_SIZE(heap_effective_size);
+    heap_init(&kernel_heap, &end, heap_effective_size, heap_index_size, 1, 1);
+    kernel_memory_end = (uint32_t)kernel_heap.start + heap_effective_size;
     uint32_t table_space = 0x400000;
     if (kernel_memory_end % table_space != 0)
     {
@@ -110,7 +171,12 @@ void kmain()
         return;
     }
 
-    fs_init();
+    fs_init(boot_option("writethrough") ? FS_MOUNT_WRITETHROUGH : FS_MOUNT_WRITEBACK);
+    pcache_init();
+    if (task_fork() == 0)
+    {
+        fs_flusher();
+    }
     trace_init();
     asm_usermode(load_indlr());
 }
\ No newline at end of file
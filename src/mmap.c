@@ -0,0 +1,570 @@
+#include <mmap.h>
+#include <kutil.h>
+#include <asm.h>
+
+pcache_page_t *pcache_pool;
+pcache_page_t *pcache_free = NULL;
+pcache_page_t *pcache_table[PCACHE_BUCKETS];
+pcache_page_t *pcache_idle_head = NULL;
+pcache_page_t *pcache_idle_tail = NULL;
+pcache_stats_t pcache_stats;
+
+void pcache_init()
+{
+    pcache_pool = kmalloc(PCACHE_PAGES * sizeof(pcache_page_t));
+    memset(pcache_table, 0, sizeof(pcache_table));
+    memset(&pcache_stats, 0, sizeof(pcache_stats_t));
+    for (uint32_t i = 0; i < PCACHE_PAGES; i++)
+    {
+        pcache_pool[i].hnext = pcache_free;
+        pcache_free = &pcache_pool[i];
+    }
+}
+
+uint32_t pcache_hash(inode_t *node, uint32_t index)
+{
+    return ((uint32_t)node / sizeof(inode_t) + index) % PCACHE_BUCKETS;
+}
+
+pcache_page_t *pcache_lookup(inode_t *node, uint32_t index)
+{
+    pcache_page_t *cached = pcache_table[pcache_hash(node, index)];
+    while (cached && (cached->node != node || cached->index != index))
+    {
+        cached = cached->hnext;
+    }
+    return cached;
+}
+
+void mmap_node_ref(inode_t *node)
+{
+    if (node->_parent)
+    {
+        node->_parent->_refs++;
+    }
+    node->_refs++;
+}
+
+void pcache_idle_remove(pcache_page_t *cached)
+{
+    if (cached->prev)
+    {
+        cached->prev->next = cached->next;
+    }
+    else
+    {
+        pcache_idle_head = cached->next;
+    }
+    if (cached->next)
+    {
+        cached->next->prev = cached->prev;
+    }
+    else
+    {
+        pcache_idle_tail = cached->prev;
+    }
+    cached->idle = 0;
+    pcache_stats.idle--;
+}
+
+void pcache_idle_push(pcache_page_t *cached)
+{
+    cached->prev = NULL;
+    cached->next = pcache_idle_head;
+    if (pcache_idle_head)
+    {
+        pcache_idle_head->prev = cached;
+    }
+    else
+    {
+        pcache_idle_tail = cached;
+    }
+    pcache_idle_head = cached;
+    cached->idle = 1;
+    pcache_stats.idle++;
+}
+
+// takes the entry out of the cache and frees its frame, returns the node it held for the caller
+// to close, as closing it may sleep
+inode_t *pcache_remove(pcache_page_t *cached)
+{
+    if (cached->idle)
+    {
+        pcache_idle_remove(cached);
+    }
+    pcache_page_t **ptr = &pcache_table[pcache_hash(cached->node, cached->index)];
+    while (*ptr != cached)
+    {
+        ptr = &(*ptr)->hnext;
+    }
+    *ptr = cached->hnext;
+    frame_release(cached->frame);
+    cached->hnext = pcache_free;
+    pcache_free = cached;
+    pcache_stats.resident--;
+    return cached->node;
+}
+
+// a full cache gives up its least recently unmapped page, NULL if every page is mapped
+pcache_page_t *pcache_insert(inode_t *node, uint32_t index, uint32_t frame)
+{
+    inode_t *evicted = NULL;
+    if (!pcache_free && pcache_idle_tail)
+    {
+        evicted = pcache_remove(pcache_idle_tail);
+    }
+    pcache_page_t *cached = pcache_free;
+    if (!cached)
+    {
+        return NULL;
+    }
+    pcache_free = cached->hnext;
+    uint32_t bucket = pcache_hash(node, index);
+    cached->node = node;
+    cached->index = index;
+    cached->frame = frame;
+    cached->idle = 0;
+    frame_hold(frame);
+    mmap_node_ref(node);
+    cached->hnext = pcache_table[bucket];
+    pcache_table[bucket] = cached;
+    pcache_stats.resident++;
+    fs_close(evicted);
+    return cached;
+}
+
+// the frame of a cached page is going into a page table entry
+void pcache_map(pcache_page_t *cached)
+{
+    if (cached->idle)
+    {
+        pcache_idle_remove(cached);
+    }
+    frame_hold(cached->frame);
+}
+
+// once the cache holds the only reference to the frame the page is idle, it stays until the
+// idle pages are over budget, so running a program again finds its text and data resident
+void pcache_release(pcache_page_t *cached)
+{
+    if (cached->idle || frame_refcount(cached->frame) > 1)
+    {
+        return;
+    }
+    pcache_idle_push(cached);
+    if (pcache_stats.idle > PCACHE_IDLE_MAX)
+    {
+        fs_close(pcache_remove(pcache_idle_tail));
+    }
+}
+
+// drops the idle pages of [from, from + count) after the file changed under them, the mapped
+// ones are left alone as before
+void pcache_invalidate(inode_t *node, uint32_t from, uint32_t count)
+{
+    if (!pcache_stats.idle || !count)
+    {
+        return;
+    }
+    for (uint32_t index = from / 0x1000; index <= (from + count - 1) / 0x1000; index++)
+    {
+        pcache_page_t *cached = pcache_lookup(node, index);
+        if (cached && cached->idle)
+        {
+            fs_close(pcache_remove(cached));
+        }
+    }
+}
+
+// the bytes a write() puts in the file are copied into the cached pages they fall in, mapped or
+// idle, so a mapping sees them and a later writeback of the page doesn't undo them
+void pcache_update(inode_t *node, uint32_t from, const char *buffer, uint32_t count)
+{
+    if (!pcache_stats.resident || !count)
+    {
+        return;
+    }
+    char *page = NULL;
+    for (uint32_t index = from / 0x1000; index <= (from + count - 1) / 0x1000; index++)
+    {
+        pcache_page_t *cached = pcache_lookup(node, index);
+        if (!cached)
+        {
+            continue;
+        }
+        if (!page)
+        {
+            page = kmalloc_a(0x1000);
+        }
+        // the frame may be out of the kernel's reach, so the page is patched in a copy
+        uint32_t physical = get_physical_address((uint32_t)page);
+        uint32_t start = max(from, index * 0x1000);
+        uint32_t end = min(from + count, (index + 1) * 0x1000);
+        paging_physcpy(cached->frame * 0x1000, physical);
+        memcpy(page + start % 0x1000, buffer + start - from, end - start);
+        paging_physcpy(physical, cached->frame * 0x1000);
+    }
+    if (page)
+    {
+        kfree(page);
+    }
+}
+
+// the cached page the entry points at, NULL for a private copy
+pcache_page_t *pcache_of(vm_area_t *area, uint32_t va, page_t *page)
+{
+    pcache_page_t *cached = pcache_lookup(area->node, (va - area->start + area->offset) / 0x1000);
+    return cached && cached->frame == (uint32_t)page->frame ? cached : NULL;
+}
+
+vm_area_t *mmap_find(task_t *task, uint32_t address)
+{
+    for (uint32_t i = 0; i < task->maps.size; i++)
+    {
+        vm_area_t *area = (vm_area_t *)task->maps.buffer[i];
+        if (address >= area->start && address < area->end)
+        {
+            return area;
+        }
+    }
+    return NULL;
+}
+
+void mmap_insert(task_t *task, uint32_t pos, uint32_t start, uint32_t end, inode_t *node, uint32_t offset,
+                 uint32_t file_end, uint8_t flags)
+{
+    vm_area_t *area = kmalloc(sizeof(vm_area_t));
+    area->start = start;
+    area->end = end;
+    area->node = node;
+    area->offset = offset;
+    area->file_end = file_end;
+    area->flags = flags;
+    mmap_node_ref(node);
+    vec_insert(&task->maps, pos, (uint32_t)area);
+}
+
+// the areas are kept sorted, a new one goes into the first gap large enough
+uint32_t mmap_map(task_t *task, inode_t *node, uint32_t offset, uint32_t length, uint8_t flags)
+{
+    length = (length + 0xfff) & 0xfffff000;
+    uint32_t start = MMAP_BASE;
+    uint32_t pos = 0;
+    for (; pos < task->maps.size; pos++)
+    {
+        vm_area_t *area = (vm_area_t *)task->maps.buffer[pos];
+        if (area->end <= start)
+        {
+            continue;
+        }
+        if (area->start - start >= length)
+        {
+            break;
+        }
+        start = area->end;
+    }
+    if (start > MMAP_END || MMAP_END - start < length)
+    {
+        return 0;
+    }
+    mmap_insert(task, pos, start, start + length, node, offset, start + length, flags);
+    return start;
+}
+
+// maps [start, end) at a fixed place, fails if it overlaps another area
+uint8_t mmap_map_at(task_t *task, uint32_t start, uint32_t end, inode_t *node, uint32_t offset, uint32_t file_end,
+                    uint8_t flags)
+{
+    uint32_t pos = 0;
+    while (pos < task->maps.size && ((vm_area_t *)task->maps.buffer[pos])->end <= start)
+    {
+        pos++;
+    }
+    if (pos < task->maps.size && ((vm_area_t *)task->maps.buffer[pos])->start < end)
+    {
+        return 0;
+    }
+    mmap_insert(task, pos, start, end, node, offset, file_end, flags);
+    return 1;
+}
+
+// fills the page mapped at va from the file, past the end of the file or the area's data
+// it reads as zeroes
+void mmap_fill(vm_area_t *area, uint32_t index, uint32_t va)
+{
+    int32_t len = 0;
+    if (va < area->file_end)
+    {
+        len = fs_read(area->node, (char *)va, index * 0x1000, min(0x1000, area->file_end - va));
+    }
+    if (len < 0)
+    {
+        len = 0;
+    }
+    memset((char *)(va + len), 0, 0x1000 - len);
+}
+
+void mmap_writeback(inode_t *node, uint32_t index, uint32_t va)
+{
+    uint32_t from = index * 0x1000;
+    if (from < node->size)
+    {
+        fs_write(node, (const char *)va, from, min(0x1000, node->size - from));
+    }
+}
+
+// a missing page is mapped from the page cache, except when a private mapping writes to it.
+// a private page still shared with the cache is copied on its first write
+uint8_t mmap_fault(uint32_t address, uint8_t write)
+{
+    task_t *task = task_curtask();
+    vm_area_t *area = mmap_find(task, address);
+    if (!area || (write && !(area->flags & MMAP_WRITE)))
+    {
+        return 0;
+    }
+    uint32_t va = address & 0xfffff000;
+    uint32_t index = (va - area->start + area->offset) / 0x1000;
+    page_t *page = get_page(va, 0, current_page_directory);
+    uint8_t private = area->flags & MMAP_PRIVATE;
+    pcache_stats.faults++;
+    if (page->present)
+    {
+        pcache_page_t *cached = pcache_of(area, va, page);
+        if (!write || !private || !cached)
+        {
+            return 0;
+        }
+        alloc_frame(page, 1, 0);
+        paging_physcpy(cached->frame * 0x1000, page->frame * 0x1000);
+        frame_release(cached->frame);
+        pcache_release(cached);
+        pcache_stats.copies++;
+        asm_flush_TLB();
+        return 1;
+    }
+    pcache_page_t *cached = pcache_lookup(area->node, index);
+    uint8_t partial = va + 0x1000 > area->file_end;
+    if ((write && private) || partial)
+    {
+        // a page of its own, one that is partly or wholly past the data is never cached
+        alloc_frame(page, 1, 0);
+        if (cached && !partial)
+        {
+            paging_physcpy(cached->frame * 0x1000, page->frame * 0x1000);
+        }
+        else
+        {
+            mmap_fill(area, index, va);
+        }
+        if (!(area->flags & MMAP_WRITE))
+        {
+            page->rw = 0;
+            asm_flush_TLB();
+        }
+        return 1;
+    }
+    if (!cached)
+    {
+        alloc_frame(page, 1, 0);
+        mmap_fill(area, index, va);
+        // someone else may have cached the page while the read slept
+        cached = pcache_lookup(area->node, index);
+        if (cached)
+        {
+            free_frame(page);
+            pcache_map(cached);
+        }
+        else
+        {
+            cached = pcache_insert(area->node, index, page->frame);
+            if (!cached)
+            {
+                if (private)
+                {
+                    // the cache is full, the page stays a private copy
+                    page->rw = (area->flags & MMAP_WRITE) ? 1 : 0;
+                    asm_flush_TLB();
+                    return 1;
+                }
+                // nothing to back a shared page with, the access fails
+                free_frame(page);
+                asm_flush_TLB();
+                return 0;
+            }
+        }
+    }
+    else
+    {
+        pcache_map(cached);
+        pcache_stats.hits++;
+    }
+    page->frame = cached->frame;
+    page->present = 1;
+    page->user = 1;
+    page->rw = !private && (area->flags & MMAP_WRITE);
+    page->dirty = 0; // filling it doesn't count as a write through the mapping
+    asm_flush_TLB();
+    return 1;
+}
+
+// faults in the mapped pages of a user buffer before a read or write of a file takes its lock, a
+// fault on them later would read a file while the lock is held. 0 if a page can't be made present
+uint8_t mmap_prefault(uint32_t address, uint32_t length, uint8_t write)
+{
+    if (!length)
+    {
+        return 1;
+    }
+    for (uint32_t va = address & 0xfffff000; va <= address + length - 1; va += 0x1000)
+    {
+        page_t *page = find_page(va, current_page_directory);
+        uint8_t ready = page && page->present && (!write || page->rw || page->cow);
+        if (!ready && !mmap_fault(va, write))
+        {
+            return 0;
+        }
+        if (va == 0xfffff000)
+        {
+            break;
+        }
+    }
+    return 1;
+}
+
+// stores through a shared mapping reach the file when the page is unmapped, or when this writes
+// the dirty pages of [addr, addr + length) back. a read() of the file doesn't see them before
+void mmap_sync(task_t *task, uint32_t addr, uint32_t length)
+{
+    uint32_t end = addr + ((length + 0xfff) & 0xfffff000);
+    for (uint32_t i = 0; i < task->maps.size; i++)
+    {
+        vm_area_t *area = (vm_area_t *)task->maps.buffer[i];
+        if (area->end <= addr || area->start >= end || !(area->flags & MMAP_SHARED))
+        {
+            continue;
+        }
+        for (uint32_t va = max(area->start, addr); va < min(area->end, end); va += 0x1000)
+        {
+            page_t *page = find_page(va, current_page_directory);
+            if (!page || !page->present || !page->dirty)
+            {
+                continue;
+            }
+            pcache_page_t *cached = pcache_of(area, va, page);
+            if (cached)
+            {
+                page->dirty = 0;
+                asm_flush_TLB();
+                mmap_writeback(area->node, cached->index, va);
+            }
+        }
+    }
+}
+
+// shared pages written through the mapping go back to the file
+void mmap_unmap_page(vm_area_t *area, uint32_t va)
+{
+    page_t *page = find_page(va, current_page_directory);
+    if (!page || !page->present)
+    {
+        return;
+    }
+    pcache_page_t *cached = pcache_of(area, va, page);
+    if (cached && (area->flags & MMAP_SHARED) && page->dirty)
+    {
+        mmap_writeback(area->node, cached->index, va);
+    }
+    free_frame(page);
+    page->rw = 0;
+    page->dirty = 0;
+    if (cached)
+    {
+        pcache_release(cached);
+    }
+}
+
+// unmaps the pages of [addr, addr + length), an area only partly in the range is trimmed or split
+void mmap_unmap(task_t *task, uint32_t addr, uint32_t length)
+{
+    uint32_t end = addr + ((length + 0xfff) & 0xfffff000);
+    uint32_t i = 0;
+    while (i < task->maps.size)
+    {
+        vm_area_t *area = (vm_area_t *)task->maps.buffer[i];
+        if (area->end <= addr || area->start >= end)
+        {
+            i++;
+            continue;
+        }
+        uint32_t from = max(area->start, addr);
+        uint32_t to = min(area->end, end);
+        for (uint32_t va = from; va < to; va += 0x1000)
+        {
+            mmap_unmap_page(area, va);
+        }
+        if (from > area->start && to < area->end)
+        {
+            vm_area_t *tail = kmalloc(sizeof(vm_area_t));
+            *tail = *area;
+            tail->start = to;
+            tail->offset += to - area->start;
+            area->end = from;
+            mmap_node_ref(area->node);
+            vec_insert(&task->maps, i + 1, (uint32_t)tail);
+            i += 2;
+        }
+        else if (from > area->start)
+        {
+            area->end = from;
+            i++;
+        }
+        else if (to < area->end)
+        {
+            area->offset += to - area->start;
+            area->start = to;
+            i++;
+        }
+        else
+        {
+            vec_erase(&task->maps, i, 1);
+            fs_close(area->node);
+            kfree(area);
+        }
+    }
+    asm_flush_TLB();
+}
+
+// on exit and exec, the task's page directory has to be the current one
+void mmap_unmap_all(task_t *task)
+{
+    mmap_unmap(task, 0, 0xfffff000);
+}
+
+// the clone of the page directory shares every frame copy on write, pages of a shared
+// writable area stay writable in both tasks instead
+void mmap_fork(task_t *parent, task_t *child)
+{
+    for (uint32_t i = 0; i < parent->maps.size; i++)
+    {
+        vm_area_t *area = kmalloc(sizeof(vm_area_t));
+        *area = *(vm_area_t *)parent->maps.buffer[i];
+        mmap_node_ref(area->node);
+        vec_push(&child->maps, (uint32_t)area);
+        if ((area->flags & (MMAP_SHARED | MMAP_WRITE)) != (MMAP_SHARED | MMAP_WRITE))
+        {
+            continue;
+        }
+        for (uint32_t va = area->start; va < area->end; va += 0x1000)
+        {
+            page_t *page = find_page(va, parent->page_dir);
+            if (page && page->cow)
+            {
+                page_t *copy = find_page(va, child->page_dir);
+                page->rw = copy->rw = 1;
+                page->cow = copy->cow = 0;
+            }
+        }
+    }
+    asm_flush_TLB();
+}
@@ -0,0 +1,67 @@
+#ifndef MMAP_H
+#define MMAP_H
+
+#include <stdint.h>
+#include <fs.h>
+#include <task.h>
+
+#define MMAP_BASE 0x40000000 // mappings are placed between here and MMAP_END, well above the heap
+#define MMAP_END 0x80000000
+#define PCACHE_PAGES 4096
+#define PCACHE_BUCKETS 256
+#define PCACHE_IDLE_MAX 1024 // pages nothing maps anymore, kept for the next exec of the same program
+
+#define MMAP_SHARED 0x1
+#define MMAP_PRIVATE 0x2
+#define MMAP_WRITE 0x4
+
+typedef struct pcache_page_t pcache_page_t;
+
+// a page of a file held in a frame of its own, shared by every mapping of it. the entry holds
+// a reference to the node, so that it can outlive the mappings
+struct pcache_page_t
+{
+    inode_t *node;
+    uint32_t index; // in pages from the start of the file
+    uint32_t frame; // holds a reference of its own, see frame_hold
+    uint8_t idle;
+    pcache_page_t *hnext;
+    pcache_page_t *prev; // lru of the idle pages, head is the most recently unmapped
+    pcache_page_t *next;
+};
+
+typedef struct
+{
+    uint32_t start;
+    uint32_t end;
+    inode_t *node;
+    uint32_t offset;   // of start in the file, page aligned
+    uint32_t file_end; // past it the area reads as zeroes, like the bss of a program
+    uint8_t flags;
+} vm_area_t;
+
+typedef struct
+{
+    uint32_t resident; // pages in the cache
+    uint32_t idle;     // of which nothing maps
+    uint32_t faults;
+    uint32_t hits; // faults mapped from a page already in the cache
+    uint32_t copies; // private pages copied on write
+} pcache_stats_t;
+
+extern pcache_stats_t pcache_stats;
+
+void pcache_init();
+void pcache_invalidate(inode_t *node, uint32_t from, uint32_t count);
+void pcache_update(inode_t *node, uint32_t from, const char *buffer, uint32_t count);
+uint32_t mmap_map(task_t *task, inode_t *node, uint32_t offset, uint32_t length, uint8_t flags);
+uint8_t mmap_map_at(task_t *task, uint32_t start, uint32_t end, inode_t *node, uint32_t offset, uint32_t file_end,
+                    uint8_t flags);
+void mmap_unmap(task_t *task, uint32_t addr, uint32_t length);
+void mmap_unmap_all(task_t *task);
+void mmap_fork(task_t *parent, task_t *child);
+uint8_t mmap_fault(uint32_t address, uint8_t write);
+uint8_t mmap_prefault(uint32_t address, uint32_t length, uint8_t write);
+void mmap_sync(task_t *task, uint32_t addr, uint32_t length);
+
+#endif
@@ -38,8 +38,13 @@ pipe_t* mqlist_open(mqlist_t *list,const char* name)
         vec_push(&list->pipes,0);
         free_index = list->names.size - 1;
     }
-    pipe_t* pipe = (pipe_t*)kmalloc(sizeof(pipe_t));
-    *pipe = pipe_new();
+    else
+    {
+        // the slot of a dead queue by another name is taken over
+        kfree((void*)list->names.buffer[free_index]);
+        pipe_free((pipe_t*)list->pipes.buffer[free_index]);
+    }
+    pipe_t* pipe = pipe_alloc();
     list->names.buffer[free_index] = (uint32_t)strdup(name);
     list->pipes.buffer[free_index] = (uint32_t)pipe;
     return pipe;
@@ -5,9 +5,12 @@
 #include <asm.h>
 #include <idt.h>
 #include <trace.h>
+#include <mmap.h>
 
 extern heap_t kernel_heap;
 bitset_t glb_frames;
+uint16_t *frame_refs; // page table entries pointing at each frame, and the page cache
+uint32_t frames_used = 0;
 
 page_directory_t *kernel_page_directory = 0x0;
 page_directory_t *current_page_directory = 0x0;
@@ -15,24 +18,47 @@ page_directory_t *current_page_directory = 0x0;
 void alloc_frame(page_t *page, int is_writable, int is_kernel)
 {
     int32_t idx = bitset_first_unset(&glb_frames);
-    bitset_set(&glb_frames, idx, 1);
     if (idx == -1)
     {
         return;
     }
+    bitset_set(&glb_frames, idx, 1);
+    frame_refs[idx] = 1;
+    frames_used++;
     page->frame = idx;
     page->present = 1;
     page->rw = is_writable ? 1 : 0;
     page->user = is_kernel ? 0 : 1;
 }
 
+void frame_hold(uint32_t frame)
+{
+    frame_refs[frame]++;
+}
+
+void frame_release(uint32_t frame)
+{
+    if (--frame_refs[frame] == 0)
+    {
+        bitset_set(&glb_frames, frame, 0);
+        frames_used--;
+    }
+}
+
+uint16_t frame_refcount(uint32_t frame)
+{
+    return frame_refs[frame];
+}
+
+// drops the entry's reference, the frame is free once nothing else points at it
 void free_frame(page_t *page)
 {
     if (page->frame)
     {
-        bitset_set(&glb_frames, page->frame, 0);
+        frame_release(page->frame);
         page->frame = 0x0;
         page->present = 0;
+        page->cow = 0;
     }
 }
 
@@ -58,6 +84,14 @@ page_t *get_page(uint32_t address, uint8_t init, page_directory_t *dir)
     return &table->pages[entry_index];
 }
 
+// unlike get_page, doesn't create a missing page table
+page_t *find_page(uint32_t address, page_directory_t *dir)
+{
+    address /= 0x1000;
+    page_table_t *table = dir->tables[address / 1024];
+    return table ? &table->pages[address % 1024] : NULL;
+}
+
 uint32_t get_physical_address(uint32_t virtual_address)
 {
     if (current_page_directory)
@@ -73,6 +107,7 @@ void paging_init()
     uint32_t total_frames = 0x100000;
     uint32_t frames_size = total_frames / 8;
     bitset_init(&glb_frames, kmalloc(frames_size), total_frames);
+    frame_refs = kmalloc(total_frames * sizeof(uint16_t));
 
     kernel_page_directory = kmalloc_a(sizeof(page_directory_t));
     memset(kernel_page_directory, 0, sizeof(page_directory_t));
@@ -80,11 +115,13 @@ void paging_init()
     for (uint32_t i = 0x0; i < (uint32_t)kernel_heap.start + kernel_heap.size; i += 0x1000)
     {
         page_t *page = get_page(i, 1, kernel_page_directory);
-        alloc_frame(page, 0, 0);
+        alloc_frame(page, 1, 1);
     }
     kernel_page_directory->physical = (uint32_t)kernel_page_directory->tables_physical;
     current_page_directory = page_directory_clone(kernel_page_directory);
     switch_page_directory((page_table_t **)current_page_directory->physical);
+    // the kernel writing to a read-only user page has to fault too, for copy on write
+    asm_enable_wp();
 
     load_int_handler(INTCODE_PAGEFAULT, page_fault);
 }
@@ -105,37 +142,107 @@ page_directory_t *page_directory_clone(page_directory_t *dir)
             }
             else
             {
-                newdir->tables[i] = page_table_clone(dir->tables[i]);
+                newdir->tables[i] = page_table_clone(dir->tables[i], i * 0x400000);
                 newdir->tables_physical[i] = (uint32_t)get_physical_address((uint32_t)newdir->tables[i]) | 0x7;
             }
         }
     }
+    // the entries of dir lost their write access
+    asm_flush_TLB();
     return newdir;
 }
 
-page_table_t *page_table_clone(page_table_t *table)
+// frees the tables of dir that aren't the kernel's and drops the frames they point at, dir must
+// not be the current directory
+void page_directory_free(page_directory_t *dir)
+{
+    for (uint32_t i = 0; i < 1024; i++)
+    {
+        page_table_t *table = dir->tables[i];
+        if (!table || table == kernel_page_directory->tables[i])
+        {
+            continue;
+        }
+        for (uint32_t j = 0; j < 1024; j++)
+        {
+            free_frame(&table->pages[j]);
+        }
+        kfree(table);
+    }
+    kfree(dir);
+}
+
+// both tables share the frames, writable ones become read-only in both until page_fault copies
+// them. the kernel stack runs the fault handler and is copied right away
+page_table_t *page_table_clone(page_table_t *table, uint32_t base)
 {
     page_table_t *new_table = kmalloc_a(sizeof(page_table_t));
     memset(new_table,0,sizeof(page_table_t));
     for (uint32_t i = 0; i < 1024; i++)
     {
-        if (table->pages[i].frame)
+        page_t *page = &table->pages[i];
+        if (!page->frame)
+        {
+            continue;
+        }
+        if (base + i * 0x1000 - kernel_stack_ptr < KERNEL_STACK_SIZE)
         {
-            alloc_frame(&new_table->pages[i], 0, 0);
-            new_table->pages[i].rw = table->pages[i].rw;
-            new_table->pages[i].accessed = table->pages[i].accessed;
-            new_table->pages[i].present = table->pages[i].present;
-            new_table->pages[i].user = table->pages[i].user;
-            new_table->pages[i].dirty = table->pages[i].dirty;
-            paging_physcpy(table->pages[i].frame * 0x1000, new_table->pages[i].frame * 0x1000);
+            alloc_frame(&new_table->pages[i], page->rw, !page->user);
+            paging_physcpy(page->frame * 0x1000, new_table->pages[i].frame * 0x1000);
+            continue;
         }
+        if (page->rw)
+        {
+            page->rw = 0;
+            page->cow = 1;
+        }
+        new_table->pages[i] = *page;
+        frame_hold(page->frame);
     }
 
     return new_table;
 }
 
+// gives the page its own frame, or keeps the frame if no one else points at it anymore
+uint8_t paging_cow(uint32_t address)
+{
+    page_t *page = find_page(address, current_page_directory);
+    if (!page || !page->present || !page->cow)
+    {
+        return 0;
+    }
+    uint32_t frame = page->frame;
+    if (frame_refcount(frame) > 1)
+    {
+        alloc_frame(page, 1, !page->user);
+        paging_physcpy(frame * 0x1000, page->frame * 0x1000);
+        frame_release(frame);
+    }
+    page->rw = 1;
+    page->cow = 0;
+    asm_flush_TLB();
+    return 1;
+}
+
 void page_fault(registers *regs)
 {
+    if (!(regs->err_code & 0x8))
+    {
+        if ((regs->err_code & 0x3) == 0x3 && paging_cow(asm_get_cr2()))
+        {
+            return;
+        }
+        if (mmap_fault(asm_get_cr2(), regs->err_code & 0x2 ? 1 : 0))
+        {
+            return;
+        }
+        if (regs->err_code & 0x4)
+        {
+            // a fault of a program takes down only the program
+            kprintf("task %u killed, page fault at %x\n", task_curtask()->pid, asm_get_cr2());
+            task_exit(TASK_EXIT_FAULT);
+        }
+    }
     const char *present = !(regs->err_code & 0x1) ? "present " : ""; // Page not present
     const char *rw = regs->err_code & 0x2 ? "read-only " : "";       // Write operation?
     const char *us = regs->err_code & 0x4 ? "user-mode " : "";       // Processor was in user-mode?
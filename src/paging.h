@@ -6,13 +6,17 @@
 
 typedef struct
 {
-    int32_t present : 1;  // Page present in memory
-    int32_t rw : 1;       // Read-only if clear, readwrite if set
-    int32_t user : 1;     // Supervisor level only if clear
-    int32_t accessed : 1; // Has the page been accessed since last refresh?
-    int32_t dirty : 1;    // Has the page been written to since last refresh?
-    int32_t unused : 7;   // Amalgamation of unused and reserved bits
-    int32_t frame : 20;   // Frame address (shifted right 12 bits)
+    uint32_t present : 1;       // Page present in memory
+    uint32_t rw : 1;            // Read-only if clear, readwrite if set
+    uint32_t user : 1;          // Supervisor level only if clear
+    uint32_t write_through : 1; // Caching policy bits, left clear
+    uint32_t cache_disable : 1;
+    uint32_t accessed : 1; // Has the page been accessed since last refresh?
+    uint32_t dirty : 1;    // Has the page been written to since last refresh?
+    uint32_t reserved : 2; // PAT and global, left clear
+    uint32_t cow : 1;      // Read-only until written, the frame is shared since a fork
+    uint32_t unused : 2;   // Available to the kernel
+    uint32_t frame : 20;   // Frame address (shifted right 12 bits)
 } page_t;
 
 typedef struct
@@ -28,15 +32,22 @@ typedef struct
 } page_directory_t;
 
 extern page_directory_t *current_page_directory;
+extern uint32_t frames_used;
 
 uint32_t get_physical_address(uint32_t virtual_address);
 void switch_page_directory(page_table_t **dir);
 void paging_init();
-page_table_t *page_table_clone(page_table_t *table);
+page_table_t *page_table_clone(page_table_t *table, uint32_t base);
 page_directory_t *page_directory_clone(page_directory_t *dir);
+void page_directory_free(page_directory_t *dir);
 void paging_physcpy(uint32_t src, uint32_t dest);
 void alloc_frame(page_t *page, int is_writable, int is_kernel);
+void free_frame(page_t *page);
+void frame_hold(uint32_t frame);
+void frame_release(uint32_t frame);
+uint16_t frame_refcount(uint32_t frame);
 page_t *get_page(uint32_t address, uint8_t init, page_directory_t *dir);
+page_t *find_page(uint32_t address, page_directory_t *dir);
 void page_fault(registers *regs);
 
 #endif
\ No newline at end of file
@@ -1,6 +1,32 @@
 #include <pathbuf.h>
 #include <kstring.h>
 #include <kutil.h>
+#include <slab.h>
+
+#define PATHBUF_NAME_SIZE 32 // names this long or shorter, with the terminator, come from a cache
+
+slab_cache_t pathbuf_name_cache = SLAB_CACHE(PATHBUF_NAME_SIZE);
+
+char *pathbuf_strdup(const char *str)
+{
+    uint32_t len = strlen(str) + 1;
+    char *copy = len <= PATHBUF_NAME_SIZE ? slab_alloc(&pathbuf_name_cache) : kmalloc(len);
+    memcpy(copy, str, len);
+    return copy;
+}
+
+void pathbuf_strfree(char *str)
+{
+    if (strlen(str) + 1 <= PATHBUF_NAME_SIZE)
+    {
+        slab_free(&pathbuf_name_cache, str);
+    }
+    else
+    {
+        kfree(str);
+    }
+}
+
 
 pathbuf_t pathbuf_root()
 {
@@ -20,7 +46,7 @@ pathbuf_t pathbuf_copy(pathbuf_t *buf)
     newbuf.fields = vec_new_s(buf->fields.size);
     for (uint32_t i = 0; i < buf->fields.size; i++)
     {
-        char *str = strdup((char *)buf->fields.buffer[i]);
+        char *str = pathbuf_strdup((char *)buf->fields.buffer[i]);
         vec_push(&newbuf.fields, (uint32_t)str);
     }
     return newbuf;
@@ -70,7 +96,7 @@ pathbuf_t pathbuf_parse(const char *address)
         }
         else if (buffer.size)
         {
-            vec_push(&fields, (uint32_t)strdup(kstring_str(&buffer)));
+            vec_push(&fields, (uint32_t)pathbuf_strdup(kstring_str(&buffer)));
             kstring_free(&buffer);
             buffer = kstring_new();
             if (c == 0)
@@ -83,6 +109,7 @@ pathbuf_t pathbuf_parse(const char *address)
             break;
         }
     }
+    kstring_free(&buffer);
     pathbuf.fields = fields;
     return pathbuf;
 }
@@ -98,7 +125,7 @@ pathbuf_t pathbuf_join(pathbuf_t *buf1, pathbuf_t *buf2)
         if (res.fields.size)
         {
             char *f = (char *)vec_pop(&res.fields);
-            kfree(f);
+            pathbuf_strfree(f);
         }
         else if (!res.is_absolute)
         {
@@ -107,7 +134,7 @@ pathbuf_t pathbuf_join(pathbuf_t *buf1, pathbuf_t *buf2)
     }
     for (uint32_t i = 0; i < buf2->fields.size; i++)
     {
-        vec_push(&res.fields, (uint32_t)strdup((char *)buf2->fields.buffer[i]));
+        vec_push(&res.fields, (uint32_t)pathbuf_strdup((char *)buf2->fields.buffer[i]));
     }
     res.is_expldir = buf2->is_expldir;
     return res;
@@ -116,7 +143,7 @@ void pathbuf_free(pathbuf_t *buf)
 {
     for (uint32_t i = 0; i < buf->fields.size; i++)
     {
-        kfree((char *)buf->fields.buffer[i]);
+        pathbuf_strfree((char *)buf->fields.buffer[i]);
     }
     vec_free(&buf->fields);
 }
@@ -164,7 +191,7 @@ pathbuf_t pathbuf_parent(pathbuf_t *buf)
     newbuf.fields = vec_new_s(buf->fields.size);
     for (uint32_t i = 0; i < buf->fields.size - 1; i++)
     {
-        char *str = strdup((char *)buf->fields.buffer[i]);
+        char *str = pathbuf_strdup((char *)buf->fields.buffer[i]);
         vec_push(&newbuf.fields, (uint32_t)str);
     }
     return newbuf;
@@ -179,10 +206,10 @@ pathbuf_t pathbuf_child(pathbuf_t *buf, const char *name, uint8_t expldir)
     newbuf.fields = vec_new_s(buf->fields.size + 1);
     for (uint32_t i = 0; i < buf->fields.size; i++)
     {
-        char *str = strdup((char *)buf->fields.buffer[i]);
+        char *str = pathbuf_strdup((char *)buf->fields.buffer[i]);
         vec_push(&newbuf.fields, (uint32_t)str);
     }
-    vec_push(&newbuf.fields, (uint32_t)strdup(name));
+    vec_push(&newbuf.fields, (uint32_t)pathbuf_strdup(name));
     return newbuf;
 }
 
@@ -0,0 +1,56 @@
+#include <pci.h>
+#include <asm.h>
+
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+// devices are addressed as (bus << 16) | (slot << 11) | (function << 8)
+uint32_t pci_device(uint32_t bus, uint32_t slot, uint32_t function)
+{
+    return (bus << 16) | (slot << 11) | (function << 8);
+}
+
+uint32_t pci_read(uint32_t device, uint8_t reg)
+{
+    asm_outl(PCI_CONFIG_ADDRESS, 0x80000000 | device | (reg & 0xfc));
+    return asm_inl(PCI_CONFIG_DATA);
+}
+
+void pci_write(uint32_t device, uint8_t reg, uint32_t value)
+{
+    asm_outl(PCI_CONFIG_ADDRESS, 0x80000000 | device | (reg & 0xfc));
+    asm_outl(PCI_CONFIG_DATA, value);
+}
+
+uint32_t pci_find_class(uint8_t class, uint8_t subclass)
+{
+    for (uint32_t bus = 0; bus < 256; bus++)
+    {
+        for (uint32_t slot = 0; slot < 32; slot++)
+        {
+            for (uint32_t function = 0; function < 8; function++)
+            {
+                uint32_t device = pci_device(bus, slot, function);
+                if ((pci_read(device, PCI_REG_VENDOR) & 0xffff) == 0xffff)
+                {
+                    if (function == 0)
+                    {
+                        break;
+                    }
+                    continue;
+                }
+                uint32_t class_reg = pci_read(device, PCI_REG_CLASS);
+                if ((class_reg >> 24) == class && ((class_reg >> 16) & 0xff) == subclass)
+                {
+                    return device;
+                }
+                // single function devices only answer on function 0
+                if (function == 0 && !(pci_read(device, PCI_REG_HEADER) & 0x800000))
+                {
+                    break;
+                }
+            }
+        }
+    }
+    return PCI_NONE;
+}
@@ -0,0 +1,24 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+#define PCI_REG_VENDOR 0x00
+#define PCI_REG_COMMAND 0x04
+#define PCI_REG_CLASS 0x08
+#define PCI_REG_HEADER 0x0c
+#define PCI_REG_BAR4 0x20
+
+#define PCI_COMMAND_IO 0x01
+#define PCI_COMMAND_BUS_MASTER 0x04
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+
+#define PCI_NONE 0xffffffff
+
+uint32_t pci_read(uint32_t device, uint8_t reg);
+void pci_write(uint32_t device, uint8_t reg, uint32_t value);
+uint32_t pci_find_class(uint8_t class, uint8_t subclass);
+
+#endif
@@ -1,4 +1,7 @@
 #include <pipe.h>
+#include <slab.h>
+
+slab_cache_t pipe_cache = SLAB_CACHE(sizeof(pipe_t));
 
 void pipe_write(pipe_t *pipe, const char *buffer, uint32_t len)
 {
@@ -46,6 +49,18 @@ pipe_t pipe_new()
     return pipe;
 }
 
+pipe_t *pipe_alloc()
+{
+    pipe_t *pipe = slab_alloc(&pipe_cache);
+    *pipe = pipe_new();
+    return pipe;
+}
+
+void pipe_free(pipe_t *pipe)
+{
+    slab_free(&pipe_cache, pipe);
+}
+
 void pipe_destroy(pipe_t *pipe)
 {
     while (pipe->list.size)
@@ -17,6 +17,8 @@ typedef struct{
 void pipe_write(pipe_t* pipe,const char* buffer,uint32_t len);
 uint32_t pipe_read(pipe_t* pipe,char* buffer,uint32_t len);
 pipe_t pipe_new();
+pipe_t *pipe_alloc();
+void pipe_free(pipe_t *pipe);
 void pipe_destroy(pipe_t* pipe);
 uint32_t pipe_close_rd(pipe_t* pipe);
 uint32_t pipe_close_wr(pipe_t* pipe);
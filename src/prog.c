@@ -4,10 +4,18 @@
 #include <elf.h>
 #include <task.h>
 #include <kutil.h>
+#include <mmap.h>
+#include <asm.h>
 
-int32_t prog_load(const char *file, uint32_t laddr, uint32_t *entry)
+// the segments are mapped privately from the file, their pages are read in or zeroed as they
+// are first touched
+int32_t prog_load(inode_t *binary, uint32_t laddr, uint32_t *entry)
 {
-    Elf32_Ehdr elf_header = *(Elf32_Ehdr *)file;
+    Elf32_Ehdr elf_header;
+    if (fs_read(binary, (char *)&elf_header, 0, sizeof(Elf32_Ehdr)) != sizeof(Elf32_Ehdr))
+    {
+        return -1;
+    }
     char elf_signature [5];
     memcpy(elf_signature,elf_header.e_ident,4);
     elf_signature[4] = 0;
@@ -15,40 +23,86 @@ int32_t prog_load(const char *file, uint32_t laddr, uint32_t *entry)
     {
         return -1;
     }
-    Elf32_Phdr *prog_arr = (Elf32_Phdr *)(file + elf_header.e_phoff);
     uint32_t prog_arrlen = elf_header.e_phnum;
-    uint32_t brk = 0;
+    uint32_t prog_arrsize = prog_arrlen * sizeof(Elf32_Phdr);
+    Elf32_Phdr *prog_arr = kmalloc(prog_arrsize);
+    if (fs_read(binary, (char *)prog_arr, elf_header.e_phoff, prog_arrsize) != (int32_t)prog_arrsize)
+    {
+        kfree(prog_arr);
+        return -1;
+    }
+    // the areas are worked out before the old image goes, so a binary that can't be mapped
+    // fails while the caller still has an image to return to
+    vm_area_t *areas = kmalloc(max(prog_arrlen, 1) * sizeof(vm_area_t));
+    uint32_t area_count = 0;
+    uint32_t last_end = 0; // of the previous segment in memory
     for (uint32_t i = 1; i < prog_arrlen; i++)
     {
         uint32_t start = prog_arr[i].p_vaddr;
-        uint32_t end = prog_arr[i].p_vaddr + prog_arr[i].p_memsz - 1;
+        uint32_t end = prog_arr[i].p_vaddr + prog_arr[i].p_memsz;
         if (start == 0)
             continue;
         if (start < laddr)
         {
             kprintf("KERNEL FAILURE: invalid load address for elf file\n");
         }
-        for (uint32_t i = start; i <= end; i += 0x1000)
+        uint32_t page_start = start & 0xfffff000;
+        uint32_t page_end = (end + 0xfff) & 0xfffff000;
+        uint32_t offset = prog_arr[i].p_offset & 0xfffff000;
+        uint32_t file_end = start + min(prog_arr[i].p_filesz, prog_arr[i].p_memsz);
+        uint8_t flags = MMAP_PRIVATE | (prog_arr[i].p_flags & PF_W ? MMAP_WRITE : 0);
+        vm_area_t *last = area_count ? &areas[area_count - 1] : NULL;
+        if (last && page_start < last->end)
         {
-            page_t *page = get_page(i, 0, current_page_directory);
-            if (!page->frame)
+            // a segment sharing a page with the one before is mapped along with it, which works
+            // only if both sit at the same distance from their place in the file and the one
+            // before has no bss, which would be read from the file instead of zeroed
+            if (page_start < last->start || page_start - offset != last->start - last->offset ||
+                last->file_end != last_end)
             {
-                alloc_frame(page, 1, 0);
+                kprintf("KERNEL FAILURE: overlapping segments in elf file\n");
+                kfree(areas);
+                kfree(prog_arr);
+                return -1;
             }
-            if(brk < end)
+            last->end = max(last->end, page_end);
+            last->file_end = max(last->file_end, file_end);
+            last->flags |= flags;
+            last_end = end;
+            continue;
+        }
+        areas[area_count].start = page_start;
+        areas[area_count].end = page_end;
+        areas[area_count].offset = offset;
+        areas[area_count].file_end = file_end;
+        areas[area_count].flags = flags;
+        area_count++;
+        last_end = end;
+    }
+    kfree(prog_arr);
+
+    task_t *task = task_curtask();
+    mmap_unmap_all(task);
+    uint32_t brk = 0;
+    for (uint32_t i = 0; i < area_count; i++)
+    {
+        vm_area_t *area = &areas[i];
+        // whatever the previous image left here would hide the new pages from the fault handler
+        for (uint32_t va = area->start; va < area->end; va += 0x1000)
+        {
+            page_t *page = find_page(va, current_page_directory);
+            if (page && page->present)
             {
-                brk = end;
-                if(brk % 0x1000)
-                {
-                    brk &= 0xfffff000;
-                    brk += 0x1000;
-                }
+                free_frame(page);
             }
         }
-        task_curtask()->brk = brk;
-        const char *data = file + prog_arr[i].p_offset;
-        memcpy((void *)start, data, prog_arr[i].p_memsz);
+        // the areas are sorted and apart, nothing is left for them to overlap
+        mmap_map_at(task, area->start, area->end, binary, area->offset, area->file_end, area->flags);
+        brk = max(brk, area->end);
     }
+    asm_flush_TLB();
+    task->brk = brk;
+    kfree(areas);
     *entry = elf_header.e_entry;
     return 0;
 }
\ No newline at end of file
@@ -2,7 +2,8 @@
 #define PROG_H
 
 #include <stdint.h>
+#include <fs.h>
 
-int32_t prog_load(const char *file, uint32_t laddr, uint32_t *entry);
+int32_t prog_load(inode_t *binary, uint32_t laddr, uint32_t *entry);
 
 #endif
\ No newline at end of file
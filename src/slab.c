@@ -0,0 +1,38 @@
+#include <slab.h>
+#include <kutil.h>
+
+void slab_grow(slab_cache_t *cache)
+{
+    char *slab = kmalloc_a(SLAB_SIZE);
+    for (uint32_t offset = 0; offset + cache->size <= SLAB_SIZE; offset += cache->size)
+    {
+        slab_object_t *object = (slab_object_t *)(slab + offset);
+        object->next = cache->free;
+        cache->free = object;
+    }
+    cache->slabs++;
+}
+
+void *slab_alloc(slab_cache_t *cache)
+{
+    if (!cache->free)
+    {
+        slab_grow(cache);
+    }
+    slab_object_t *object = cache->free;
+    cache->free = object->next;
+    cache->used++;
+    return object;
+}
+
+void slab_free(slab_cache_t *cache, void *object)
+{
+    if (!object)
+    {
+        return;
+    }
+    slab_object_t *freed = object;
+    freed->next = cache->free;
+    cache->free = freed;
+    cache->used--;
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+
+#define SLAB_SIZE 0x1000
+
+typedef struct slab_object_t slab_object_t;
+
+struct slab_object_t
+{
+    slab_object_t *next;
+};
+
+// a free list of objects of one size, carved out of pages taken from the heap. pages are kept
+// once taken, so the objects of a cache never go back to the general heap
+typedef struct
+{
+    uint32_t size;
+    slab_object_t *free;
+    uint32_t slabs;
+    uint32_t used;
+} slab_cache_t;
+
+// a cache needs no setup beyond being defined with this
+#define SLAB_CACHE(object_size) {((object_size) + 3) & ~3, NULL, 0, 0}
+
+void *slab_alloc(slab_cache_t *cache);
+void slab_free(slab_cache_t *cache, void *object);
+
+#endif
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include <prog.h>
 #include <pipe.h>
 #include <mq.h>
+#include <mmap.h>
 
 #define syscall_handlers_cap 64
 
@@ -134,18 +135,7 @@ int32_t syscall_setcwd(registers *regs)
 
 int32_t syscall_exit(registers *regs)
 {
-    int16_t statuscode = regs->ebx;
-    task_t *task = task_curtask();
-    task_t *parent = task->parent;
-    task->exit_status = statuscode;
-    task_close_all_fds();
-    if ((parent->wait == TASK_WAIT_PID && parent->chwait == task) || parent->wait == TASK_WAIT_ALL)
-    {
-        parent->chwait = task;
-        parent->wait = TASK_WAIT_NONE;
-        task_awake(parent);
-    }
-    task_sleep();
+    task_exit(regs->ebx);
     return 0;
 }
 
@@ -162,11 +152,15 @@ int32_t syscall_open(registers *regs)
     inode_t *node = fs_open(&pathbuf, flag_create, flag_truncate, 0, 0, &res);
     if (res != 0)
     {
+        fs_close(node);
         return syscall_translate_fs_err(res);
     }
     fd_t fd;
     fd.access = FD_ACCESS_WRITE | FD_ACCESS_READ;
     fd.pos = 0;
+    fd.ra.next = 0;
+    fd.ra.window = 0;
+    fd.ra.end = 0;
     fd.ptr = node;
     fd.kind = FD_KIND_DISK;
     fd.isopen = 1;
@@ -199,6 +193,7 @@ int32_t syscall_opendir(registers *regs)
     inode_t *node = fs_open(&pathbuf, 0, 0, 1, 0, &res);
     if (res != 0)
     {
+        fs_close(node);
         return syscall_translate_fs_err(res);
     }
     fd_t fd;
@@ -256,11 +251,131 @@ int32_t syscall_stat(registers *regs)
         stat->isdir = node->type == inode_type_dir;
         stat->size = node->size;
         stat->blocks = node->alloc + 1;
+        stat->contended = node->_lock.contended;
     }
+    fs_close(node);
     pathbuf_free(&pathbuf);
     return status;
 }
 
+int32_t syscall_fsstat(registers *regs)
+{
+    fsstat_t *stat = (fsstat_t *)regs->ebx;
+    stat->bcache_hits = bcache_stats.hits;
+    stat->bcache_misses = bcache_stats.misses;
+    stat->bcache_writebacks = bcache_stats.writebacks;
+    stat->bcache_evictions = bcache_stats.evictions;
+    stat->bcache_prefetches = bcache_stats.prefetches;
+    stat->dcache_hits = dcache_stats.hits;
+    stat->dcache_misses = dcache_stats.misses;
+    stat->dcache_evictions = dcache_stats.evictions;
+    stat->dcache_resident = dcache_stats.resident;
+    stat->balloc_contended = balloc_lock.contended;
+    stat->pcache_resident = pcache_stats.resident;
+    stat->pcache_idle = pcache_stats.idle;
+    stat->pcache_hits = pcache_stats.hits;
+    stat->pcache_faults = pcache_stats.faults;
+    stat->pcache_copies = pcache_stats.copies;
+    stat->frames_used = frames_used;
+    return 0;
+}
+
+int32_t syscall_fsync(registers *regs)
+{
+    task_t *task = task_curtask();
+    uint32_t fd_id = regs->ebx;
+    if (fd_id >= task->table.size)
+    {
+        return SYSCALL_ERR_INVALID_FD;
+    }
+    fd_t *fd = &task->table.records[fd_id];
+    if (!fd->isopen)
+    {
+        return SYSCALL_ERR_INVALID_FD;
+    }
+    if (fd->kind != FD_KIND_DISK && fd->kind != FD_KIND_DIR)
+    {
+        return SYSCALL_ERR_INVALID_FD;
+    }
+    int32_t ret = fs_fsync((inode_t *)fd->ptr);
+    if (ret == FS_ERR_DELETED)
+    {
+        return SYSCALL_ERR_UNLINKED_FILE;
+    }
+    return ret;
+}
+
+int32_t syscall_sync(_unused registers *regs)
+{
+    fs_sync();
+    return 0;
+}
+
+// maps length bytes of the file from offset, which has to be page aligned, and returns the address.
+// the pages are read in as they are first touched
+int32_t syscall_mmap(registers *regs)
+{
+    task_t *task = task_curtask();
+    uint32_t fd_id = regs->ebx;
+    uint32_t offset = regs->ecx;
+    uint32_t length = regs->edx;
+    uint8_t flags = regs->esi;
+    if (fd_id >= task->table.size)
+    {
+        return SYSCALL_ERR_INVALID_FD;
+    }
+    fd_t *fd = &task->table.records[fd_id];
+    if (!fd->isopen || fd->kind != FD_KIND_DISK)
+    {
+        return SYSCALL_ERR_INVALID_FD;
+    }
+    uint8_t kind = flags & (MMAP_SHARED | MMAP_PRIVATE);
+    if (!length || offset % 0x1000 || (kind != MMAP_SHARED && kind != MMAP_PRIVATE))
+    {
+        return SYSCALL_ERR_INVALID_MAP;
+    }
+    if ((flags & MMAP_WRITE) && kind == MMAP_SHARED && !(fd->access & FD_ACCESS_WRITE))
+    {
+        return SYSCALL_ERR_READONLY;
+    }
+    uint32_t addr = mmap_map(task, (inode_t *)fd->ptr, offset, length, flags);
+    if (!addr)
+    {
+        return SYSCALL_ERR_INVALID_MAP;
+    }
+    return addr;
+}
+
+int32_t syscall_munmap(registers *regs)
+{
+    uint32_t addr = regs->ebx;
+    uint32_t length = regs->ecx;
+    if (addr % 0x1000 || addr < MMAP_BASE || addr >= MMAP_END || length > MMAP_END - addr)
+    {
+        return SYSCALL_ERR_INVALID_MAP;
+    }
+    mmap_unmap(task_curtask(), addr, length);
+    return 0;
+}
+
+int32_t syscall_msync(registers *regs)
+{
+    uint32_t addr = regs->ebx;
+    uint32_t length = regs->ecx;
+    if (addr % 0x1000 || addr < MMAP_BASE || addr >= MMAP_END || length > MMAP_END - addr)
+    {
+        return SYSCALL_ERR_INVALID_MAP;
+    }
+    mmap_sync(task_curtask(), addr, length);
+    return 0;
+}
+
+int32_t syscall_heapbench(registers *regs)
+{
+    heap_bench(&kernel_heap, (heap_bench_t *)regs->ebx);
+    return 0;
+}
+
 int32_t syscall_close(registers *regs)
 {
     task_t *task = task_curtask();
@@ -281,11 +396,19 @@ int32_t syscall_close(registers *regs)
 int32_t syscall_read_disk(fd_t *fd, char *ptr, int32_t len)
 {
     inode_t *node = fd->ptr;
+    if (!mmap_prefault((uint32_t)ptr, len, 1))
+    {
+        return SYSCALL_ERR_FAULT;
+    }
     int32_t ret = fs_read(node, ptr, fd->pos, len);
     if (ret == FS_ERR_DELETED)
     {
         return SYSCALL_ERR_UNLINKED_FILE;
     }
+    if (ret > 0)
+    {
+        fs_readahead(node, &fd->ra, fd->pos, ret);
+    }
     fd->pos += ret;
     return ret;
 }
@@ -358,6 +481,10 @@ int32_t syscall_read(registers *regs)
 int32_t syscall_write_disk(fd_t *fd, const char *ptr, int32_t len)
 {
     inode_t *node = fd->ptr;
+    if (!mmap_prefault((uint32_t)ptr, len, 0))
+    {
+        return SYSCALL_ERR_FAULT;
+    }
     int32_t ret = fs_write(node, ptr, fd->pos, len);
     if (ret == FS_ERR_DELETED)
     {
@@ -455,11 +582,13 @@ inode_t* exec_open(pathbuf_t* path,int8_t* rres)
         binary = fs_open(&respath, 0, 0, 0, 0, rres);
         if (*rres != 0)
         {
+            fs_close(binary);
             pathbuf_free(&respath);
             respath = pathbuf_join(&bindir,path);
             binary = fs_open(&respath, 0, 0, 0, 0, rres);
             if(*rres != 0)
             {
+                fs_close(binary);
                 binary = NULL;
             }
         }
@@ -469,7 +598,8 @@ inode_t* exec_open(pathbuf_t* path,int8_t* rres)
         binary = fs_open(path, 0, 0, 0, 0, rres);
         if (*rres != 0)
         {
-            binary = NULL;   
+            fs_close(binary);
+            binary = NULL;
         }
     }
     pathbuf_free(&bindir);
@@ -485,24 +615,32 @@ int32_t syscall_exec(registers *regs)
     {
         return syscall_translate_fs_err(rres);
     }
-    char *program = kmalloc(binary->size);
-    int32_t rsl = fs_read(binary, program, 0, binary->size);
-    if (rsl < 0)
+    // the arguments may live in the image about to be replaced
+    vec_t args = vec_new();
+    for (const char **argv = (const char **)regs->ecx; *argv; argv++)
     {
-        return syscall_translate_fs_err(rsl);
+        vec_push(&args, (uint32_t)strdup(*argv));
     }
-
+    vec_push(&args, 0);
     uint32_t entry;
-    rsl = prog_load(program, kernel_memory_end, &entry);
-    kfree(program);
+    int32_t rsl = prog_load(binary, kernel_memory_end, &entry);
+    fs_close(binary);
+    if (rsl == 0)
+    {
+        uint32_t stack_ptr = regs->esp + USER_STACK_SIZE - 0x40;
+        place_args_vector((const char **)args.buffer, &stack_ptr);
+        regs->eip = entry;
+        regs->useresp = stack_ptr;
+    }
+    for (uint32_t i = 0; i + 1 < args.size; i++)
+    {
+        kfree((void *)args.buffer[i]);
+    }
+    vec_free(&args);
     if (rsl != 0)
     {
         return SYSCALL_ERR_NOT_EXECUTABLE;
     }
-    uint32_t stack_ptr = regs->esp + USER_STACK_SIZE - 0x40;
-    place_args_vector((const char**)regs->ecx,&stack_ptr);
-    regs->eip = entry;
-    regs->useresp = stack_ptr;
     pathbuf_free(&path);
     return 0;
 }
@@ -530,8 +668,7 @@ int32_t syscall_fork(_unused registers *regs)
 
 int32_t syscall_pipe(registers *regs)
 {
-    pipe_t* pipe = kmalloc(sizeof(pipe_t));
-    *pipe = pipe_new();
+    pipe_t* pipe = pipe_alloc();
     uint32_t* fd_buffer = (uint32_t*) regs->ebx;
     fd_t fd;
     fd.isopen = 1;
@@ -602,5 +739,12 @@ void syscalls_init()
     syscall_handlers[SYSCALL_PIPE] = syscall_pipe;
     syscall_handlers[SYSCALL_DUP] = syscall_dup;
     syscall_handlers[SYSCALL_MQOPEN] = syscall_mqopen;
+    syscall_handlers[SYSCALL_FSSTAT] = syscall_fsstat;
+    syscall_handlers[SYSCALL_FSYNC] = syscall_fsync;
+    syscall_handlers[SYSCALL_SYNC] = syscall_sync;
+    syscall_handlers[SYSCALL_MMAP] = syscall_mmap;
+    syscall_handlers[SYSCALL_MUNMAP] = syscall_munmap;
+    syscall_handlers[SYSCALL_HEAPBENCH] = syscall_heapbench;
+    syscall_handlers[SYSCALL_MSYNC] = syscall_msync;
     load_int_handler(INTCODE_SYSCALL, syscalls_handle);
 }
\ No newline at end of file
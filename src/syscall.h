@@ -27,6 +27,13 @@ extern uint32_t kernel_memory_end;
 #define SYSCALL_PIPE 18
 #define SYSCALL_DUP 19
 #define SYSCALL_MQOPEN 20
+#define SYSCALL_FSSTAT 21
+#define SYSCALL_FSYNC 22
+#define SYSCALL_SYNC 23
+#define SYSCALL_MMAP 24
+#define SYSCALL_MUNMAP 25
+#define SYSCALL_HEAPBENCH 26
+#define SYSCALL_MSYNC 27
 
 #define SYSCALL_ERR_INVALID_FD -1
 #define SYSCALL_ERR_WRITEONLY -2
@@ -38,6 +45,8 @@ extern uint32_t kernel_memory_end;
 #define SYSCALL_ERR_HAS_CHILD -8
 #define SYSCALL_ERR_NOT_EXECUTABLE -9
 #define SYSCALL_ERR_INVAL_CHILDPID -10
+#define SYSCALL_ERR_INVALID_MAP -11
+#define SYSCALL_ERR_FAULT -12 // a buffer passed in can't be mapped
 
 typedef int32_t (*syscall_handler_t)(registers *);
 
@@ -47,8 +56,29 @@ typedef struct
     uint8_t isdir;
     uint32_t size;
     uint32_t blocks;
+    uint32_t contended; // waits on the node's lock since it was cached
 } stat_t;
 
+typedef struct
+{
+    uint32_t bcache_hits;
+    uint32_t bcache_misses;
+    uint32_t bcache_writebacks;
+    uint32_t bcache_evictions;
+    uint32_t bcache_prefetches;
+    uint32_t dcache_hits;
+    uint32_t dcache_misses;
+    uint32_t dcache_evictions;
+    uint32_t dcache_resident;
+    uint32_t balloc_contended;
+    uint32_t pcache_resident;
+    uint32_t pcache_idle;
+    uint32_t pcache_hits;
+    uint32_t pcache_faults;
+    uint32_t pcache_copies;
+    uint32_t frames_used;
+} fsstat_t;
+
 void syscall_test();
 int32_t syscall_translate_fs_err(int32_t err);
 void syscalls_handle(registers *regs);
@@ -69,6 +99,13 @@ int32_t syscall_wait(registers *regs);
 int32_t syscall_waitpid(registers *regs);
 int32_t syscall_getpid(registers *regs);
 int32_t syscall_mqopen(registers *regs);
+int32_t syscall_fsstat(registers *regs);
+int32_t syscall_fsync(registers *regs);
+int32_t syscall_sync(registers *regs);
+int32_t syscall_mmap(registers *regs);
+int32_t syscall_munmap(registers *regs);
+int32_t syscall_heapbench(registers *regs);
+int32_t syscall_msync(registers *regs);
 void syscalls_init();
 
 #endif
\ No newline at end of file
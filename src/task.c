@@ -3,6 +3,9 @@
 #include <kutil.h>
 #include <asm.h>
 #include <fs.h>
+#include <bcache.h>
+#include <mmap.h>
+#include <slab.h>
 
 #define KERNEL_STACK_SIZE 0x2000
 #define INIT_PID 1
@@ -17,6 +20,7 @@ task_t *current_task;
 uint32_t kernel_stack_ptr;
 uint32_t user_stack_ptr;
 vec_t tasklist; // keeps task_t* pointers
+slab_cache_t task_cache = SLAB_CACHE(sizeof(task_t));
 
 uint32_t multk_getpid()
 {
@@ -53,7 +57,7 @@ void task_switch(uint32_t sleep)
 uint32_t task_fork()
 {
     task_t *curtask = (task_t *)kqueue_peek(&rr_queue);
-    task_t *newtask = kmalloc(sizeof(task_t));
+    task_t *newtask = slab_alloc(&task_cache);
     newtask->pid = task_count++;
     newtask->brk = curtask->brk;
     newtask->ebp = asm_get_ebp();
@@ -64,6 +68,8 @@ uint32_t task_fork()
         newtask->exit_status = -1;
         newtask->wait = TASK_WAIT_NONE;
         newtask->page_dir = page_directory_clone(curtask->page_dir);
+        newtask->maps = vec_new();
+        mmap_fork(curtask, newtask);
         newtask->table = fd_table_clone(&curtask->table);
         kqueue_push(&rr_queue, (uint32_t)newtask);
         newtask->cwd = pathbuf_copy(&curtask->cwd);
@@ -113,8 +119,9 @@ fd_table init_fdt()
 void task_free(task_t *task)
 {
     pathbuf_free(&task->cwd);
+    vec_free(&task->maps);
     kfree(task->table.records);
-    kfree(task->page_dir);
+    page_directory_free(task->page_dir);
 }
 
 task_t *task_gettask(uint32_t pid)
@@ -128,6 +135,7 @@ void task_killtask(task_t *task)
     task_orphan_all(task);
     task_free(task);
     tasklist.buffer[pid] = 0;
+    slab_free(&task_cache, task);
 }
 
 task_t *task_find_zombie(task_t *task)
@@ -157,11 +165,12 @@ void task_orphan_all(task_t *task)
 
 void multitasking_init()
 {
-    task_t *first = kmalloc(sizeof(task_t));
+    task_t *first = slab_alloc(&task_cache);
     tasklist = vec_new();
     first->pid = task_count++;
     first->page_dir = current_page_directory;
     first->brk = 0;
+    first->maps = vec_new();
     rr_queue = kqueue_new();
     kqueue_push(&rr_queue, (uint32_t)first);
     current_task = first;
@@ -189,7 +198,25 @@ void task_close_all_fds()
     }
 }
 
+// the task becomes a zombie until its parent waits for it, this never returns
+void task_exit(int16_t status)
+{
+    task_t *task = task_curtask();
+    task_t *parent = task->parent;
+    task->exit_status = status;
+    mmap_unmap_all(task);
+    task_close_all_fds();
+    if ((parent->wait == TASK_WAIT_PID && parent->chwait == task) || parent->wait == TASK_WAIT_ALL)
+    {
+        parent->chwait = task;
+        parent->wait = TASK_WAIT_NONE;
+        task_awake(parent);
+    }
+    task_sleep();
+}
+
 void task_timer(__attribute__((unused)) registers *regs)
 {
+    bcache_tick();
     task_switch(0);
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <paging.h>
 #include <descriptor.h>
 #include <pathbuf.h>
+#include <vec.h>
 
 #define KERNEL_STACK_SIZE 0x2000
 #define USER_STACK_SIZE 0x2000
@@ -13,6 +14,8 @@
 #define TASK_WAIT_PID 2
 #define TASK_WAIT_ALL 3
 
+#define TASK_EXIT_FAULT 139 // the status of a task killed by a fault it can't recover from
+
 extern uint32_t kernel_stack_ptr;
 extern uint32_t user_stack_ptr;
 
@@ -26,6 +29,7 @@ struct task_t
     uint32_t ebp;
     uint32_t brk;
     page_directory_t *page_dir;
+    vec_t maps; // vm_area_t* of the mapped files, sorted by address
     fd_table table;
     pathbuf_t cwd;
     task_t *parent;
@@ -53,5 +57,6 @@ void task_killtask(task_t *task);
 void task_orphan_all(task_t *task);
 void task_close_fd(uint32_t fd_id);
 void task_close_all_fds();
+void task_exit(int16_t status);
 
 #endif
\ No newline at end of file
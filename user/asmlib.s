@@ -60,6 +60,27 @@ global %1
     ret
 %endmacro
 
+%macro SYSCALL_5R 2
+global %1
+%1:
+    push ebp
+    mov ebp, esp
+    push ebx
+    push esi
+
+    mov eax, %2
+    mov ebx, [ebp+8]
+    mov ecx, [ebp+12]
+    mov edx, [ebp+16]
+    mov esi, [ebp+20]
+    int 0x80
+
+    pop esi
+    pop ebx
+    mov esp ,ebp
+    pop ebp
+    ret
+%endmacro
 
 section .text
     SYSCALL_2R exit, 1
@@ -81,4 +102,11 @@ section .text
     SYSCALL_2R sbrk, 17
     SYSCALL_2R pipe, 18
     SYSCALL_2R dup, 19
-    SYSCALL_3R mqopen, 20
\ No newline at end of file
+    SYSCALL_3R mqopen, 20
+    SYSCALL_2R fsstat, 21
+    SYSCALL_2R fsync, 22
+    SYSCALL_1R sync, 23
+    SYSCALL_5R mmap, 24
+    SYSCALL_3R munmap, 25
+    SYSCALL_2R heapbench, 26
+    SYSCALL_3R msync, 27
\ No newline at end of file
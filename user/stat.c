@@ -1,18 +1,45 @@
 #include <stdlib.h>
 
+void cachestat()
+{
+    fsstat_t s;
+    fsstat(&s);
+    printf("bcache: hits=%u misses=%u writebacks=%u evictions=%u prefetches=%u\n",s.bcache_hits,s.bcache_misses,s.bcache_writebacks,s.bcache_evictions,s.bcache_prefetches);
+    printf("inodes: hits=%u misses=%u evictions=%u resident=%u bytes\n",s.dcache_hits,s.dcache_misses,s.dcache_evictions,s.dcache_resident);
+    printf("allocator: contended=%u\n",s.balloc_contended);
+    printf("mapped pages: resident=%u idle=%u faults=%u hits=%u copied=%u\n",s.pcache_resident,s.pcache_idle,s.pcache_faults,s.pcache_hits,s.pcache_copies);
+    printf("memory: frames=%u\n",s.frames_used);
+}
+
+void heapstat()
+{
+    heap_bench_t b;
+    heapbench(&b);
+    printf("kernel heap: allocs=%u avg=%u max=%u cycles\n",b.allocs,b.allocs ? b.alloc_cycles/b.allocs : 0,b.alloc_max);
+    printf("kernel heap: frees=%u avg=%u max=%u cycles\n",b.frees,b.frees ? b.free_cycles/b.frees : 0,b.free_max);
+}
+
 int fmain(int argc, char** argv)
 {
     int status = 0;
     if(argc == 1)
     {
-        printf("usage: state [FILES...]\n");
+        printf("usage: state [-c] [-h] [FILES...]\n");
+    }
+    else if(strcmp(argv[1],"-c") == 0)
+    {
+        cachestat();
+    }
+    else if(strcmp(argv[1],"-h") == 0)
+    {
+        heapstat();
     }
     else for(int i=1;i<argc;i++){
         stat_t s;
         int rsl = stat(argv[i],&s);
         if(rsl == 0)
         {
-            printf("%s:%s size=%u blocks=%u\n",s.isdir?"dir":"file",argv[i],s.size,s.blocks);
+            printf("%s:%s size=%u blocks=%u contended=%u\n",s.isdir?"dir":"file",argv[i],s.size,s.blocks,s.contended);
         }
         else{
             status = 1;
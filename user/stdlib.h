@@ -8,14 +8,49 @@
 #define STDOUT 1
 #define STDIN 0
 
+#define MAP_SHARED 0x1
+#define MAP_PRIVATE 0x2
+#define MAP_WRITE 0x4
+
 typedef struct
 {
     uint32_t index;
     uint8_t isdir;
     uint32_t size;
     uint32_t blocks;
+    uint32_t contended; // waits on the node's lock since it was cached
 } stat_t;
 
+typedef struct
+{
+    uint32_t bcache_hits;
+    uint32_t bcache_misses;
+    uint32_t bcache_writebacks;
+    uint32_t bcache_evictions;
+    uint32_t bcache_prefetches;
+    uint32_t dcache_hits;
+    uint32_t dcache_misses;
+    uint32_t dcache_evictions;
+    uint32_t dcache_resident;
+    uint32_t balloc_contended;
+    uint32_t pcache_resident;
+    uint32_t pcache_idle;
+    uint32_t pcache_hits;
+    uint32_t pcache_faults;
+    uint32_t pcache_copies;
+    uint32_t frames_used;
+} fsstat_t;
+
+typedef struct
+{
+    uint32_t allocs;
+    uint32_t alloc_cycles;
+    uint32_t alloc_max;
+    uint32_t frees;
+    uint32_t free_cycles;
+    uint32_t free_max;
+} heap_bench_t;
+
 int write(int fd, const void *buffer, int length);
 int read(int fd, const void *buffer, int length);
 int open(const char *path, int flags);
@@ -36,6 +71,13 @@ int fork();
 int pipe(int* fds);
 int mqopen(const char* name,int* fds);
 int dup(int fd);
+int fsstat(fsstat_t* stat);
+int fsync(int fd);
+int sync();
+void* mmap(int fd, int offset, int length, int flags);
+int munmap(void* addr, int length);
+int msync(void* addr, int length);
+int heapbench(heap_bench_t* bench);
 
 void* malloc(int size);
 void free(void* ptr);